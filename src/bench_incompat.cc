@@ -0,0 +1,101 @@
+#include <chrono>
+#include <algorithm>
+#include "tree.h"
+#include "splits.h"
+#include "thread_pool.h"
+#include "build_incompat_graph.h"
+
+// the edge list as build_incompat_graph computed it with set<string> splits
+void
+ReferenceIncompatEdgeList(
+    SplitDatabase & left_splits,
+    SplitDatabase & right_splits,
+    IntEdgeList & E
+    )
+{
+    for (SplitDatabase::iterator L = left_splits.begin();
+         L != left_splits.end();
+         ++L)
+    {
+        for (SplitDatabase::iterator R = right_splits.begin();
+             R != right_splits.end();
+             ++R)
+        {
+            if(SplitsAreIncompatible(L->first, R->first))
+            {
+                E.push_back(make_pair(L->first.id, R->first.id));
+            }
+        }
+    }
+    sort(E.begin(), E.end());
+}
+
+
+void
+ReadSplitsFile(const string & name, SplitDatabase & splits)
+{
+    ifstream in(name.c_str());
+    DIE_IF(!in, "Can't read " + name);
+    ReadSplitsMapping(in, splits);
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: bench_incompat base1 base2 [repeats [threads]]" << endl << endl;
+
+        cerr << "Times the construction of the incompatibility edge list between" << endl
+             << "base1_splits and base2_splits against the original set-based" << endl
+             << "split test, and checks that both produce the same edges." << endl;
+        exit(3);
+    }
+    int repeats = (argc > 3) ? atoi(argv[3]) : 1;
+    int threads = (argc > 4) ? atoi(argv[4]) : 1;
+    ThreadPool * pool = (threads > 1) ? new ThreadPool(threads) : 0;
+
+    SplitDatabase left_splits, right_splits;
+    ReadSplitsFile(string(argv[1]) + "_splits", left_splits);
+    ReadSplitsFile(string(argv[2]) + "_splits", right_splits);
+    cout << "Splits: " << left_splits.size() << " x " << right_splits.size() << endl;
+
+    IntEdgeList ref, fast;
+
+    // wall clock time, since the threads add up cpu time
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+    {
+        ref.clear();
+        ReferenceIncompatEdgeList(left_splits, right_splits, ref);
+    }
+    double ref_secs = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count() / repeats;
+
+    cout << "Edges: " << ref.size() << endl
+         << "set<string> test:           " << ref_secs << " s" << endl;
+
+    // the bitset scan and the split index
+    for (int k = 0; k < 2; k++)
+    {
+        bool use_index = (k == 1);
+        long examined = 0;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+        {
+            fast.clear();
+            examined = CreateIncompatEdgeList(left_splits, right_splits, fast, pool, use_index);
+        }
+        double fast_secs = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count() / repeats;
+
+        cout << (use_index ? "split index: " : "bitset scan: ") 
+             << "               " << fast_secs << " s (" 
+             << examined << " pairs examined)" << endl;
+        DIE_IF(ref != fast, "The edge lists differ!");
+    }
+    cout << "The edge lists match." << endl;
+    delete pool;
+    return 0;
+}
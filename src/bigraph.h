@@ -2,31 +2,141 @@
 #define _BIGRAPH_H_
 
 #include <iostream>
-#include <map>		
-#include <set>		
-#include <iterator>	
+#include <map>
+#include <set>
+#include <vector>
+#include <iterator>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <cstdlib>
+#include "bitvec.h"
 
 using namespace std;
 
+//
+// out = the elements of the sorted range [a, a_end) that are also in the
+// sorted range [b, b_end). When b is much longer than a, every element of a
+// is looked up in b by galloping from where the last one was found.
+//
+template<class label_t>
+void intersect_sorted(const label_t* a, const label_t* a_end, const label_t* b, const label_t* b_end, vector<label_t>& out) {
+
+  out.clear();
+  if(b_end - b <= 16 * (a_end - a)) {
+
+    set_intersection(a, a_end, b, b_end, back_inserter(out));
+    return;
+  }
+
+  for(; a != a_end && b != b_end; a++) {
+
+    // b[hi / 2] < *a <= b[hi], or hi is past the end
+    size_t n = b_end - b, hi = 1;
+    while(hi < n && b[hi] < *a) hi *= 2;
+    b = lower_bound(b + hi / 2, b + min(hi + 1, n), *a);
+
+    if(b != b_end && *b == *a) out.push_back(*a);
+  }
+}
+
+//
+// A bipartite graph in compressed sparse row form. The nodes of each side
+// are kept sorted, each with the sorted array of its neighbours. The edges
+// are added first and then finish() builds the rows, once; after that the
+// graph only changes by removing edges, which shortens the rows in place and
+// marks the nodes that lose their last edge in a bitmap of removed nodes.
+//
 template<class left_label_t, class right_label_t>
 class Bigraph {
 
  private:
 
-  map<left_label_t, set<right_label_t> > left_adjacency;
-  map<right_label_t, set<left_label_t> > right_adjacency;
-  
+  template<class node_label_t, class other_label_t>
+  struct rows {
+
+    vector<node_label_t> labels;
+    vector<size_t> begin, end;          // the neighbours of labels[i] are
+    vector<other_label_t> neighbours;   // neighbours[begin[i]..end[i])
+    vector<bitword_t> removed;
+
+    // build from the sorted, distinct edges
+    void build(const vector<pair<node_label_t, other_label_t> >& edges) {
+
+      for(size_t e = 0; e < edges.size(); e++) {
+
+	if(labels.empty() || labels.back() != edges[e].first) {
+
+	  labels.push_back(edges[e].first);
+	  begin.push_back(e); end.push_back(e);
+	}
+	neighbours.push_back(edges[e].second);
+	end.back()++;
+      }
+      removed.assign(WordsFor(labels.size()), 0);
+    }
+
+    // the index of node, or -1 if it is not in the graph
+    long find(const node_label_t& node) const {
+
+      typename vector<node_label_t>::const_iterator it = lower_bound(labels.begin(), labels.end(), node);
+      return (it != labels.end() && *it == node) ? it - labels.begin() : -1;
+    }
+  };
+
+  rows<left_label_t, right_label_t> left;
+  rows<right_label_t, left_label_t> right;
+  vector<pair<left_label_t, right_label_t> > added;
+
  public:
 
-  map<left_label_t, set<right_label_t> >& get_left_adjacency() { return left_adjacency; }
-  map<right_label_t, set<left_label_t> >& get_right_adjacency() { return right_adjacency; }
+  void add_edge(const left_label_t& left_node, const right_label_t& right_node) { added.push_back(make_pair(left_node, right_node)); }
+  void finish();
 
   size_t read(const char* filename);
   size_t remove_biclique(const set<left_label_t>& left_nodes, const set<right_label_t>& right_nodes);
+
+  size_t num_left() const { return left.labels.size(); }
+  const left_label_t& left_node(size_t i) const { return left.labels[i]; }
+  bool left_removed(size_t i) const { return TestBit(&left.removed[0], i); }
+  const right_label_t* left_begin(size_t i) const { return &left.neighbours[0] + left.begin[i]; }
+  const right_label_t* left_end(size_t i) const { return &left.neighbours[0] + left.end[i]; }
+
+  size_t num_right() const { return right.labels.size(); }
+  const right_label_t& right_node(size_t i) const { return right.labels[i]; }
+  bool right_removed(size_t i) const { return TestBit(&right.removed[0], i); }
+  const left_label_t* right_begin(size_t i) const { return &right.neighbours[0] + right.begin[i]; }
+  const left_label_t* right_end(size_t i) const { return &right.neighbours[0] + right.end[i]; }
+
+  size_t num_edges() const {
+
+    size_t count(0);
+    for(size_t i = 0; i < left.labels.size(); i++)
+      count += left.end[i] - left.begin[i];
+    return count;
+  }
+
+  void common_left_neighbours(const set<right_label_t>& right_nodes, vector<left_label_t>& result) const;
 };
 
+template<class left_label_t, class right_label_t>
+void Bigraph<left_label_t, right_label_t>::finish() {
+
+  if(added.empty()) return;
+  sort(added.begin(), added.end());
+  added.erase(unique(added.begin(), added.end()), added.end());
+  left.build(added);
+
+  vector<pair<right_label_t, left_label_t> > swapped;
+  for(size_t e = 0; e < added.size(); e++)
+    swapped.push_back(make_pair(added[e].second, added[e].first));
+  vector<pair<left_label_t, right_label_t> >().swap(added);
+
+  sort(swapped.begin(), swapped.end());
+  right.build(swapped);
+}
+
 template<class left_label_t, class right_label_t>
 size_t Bigraph<left_label_t, right_label_t>::read(const char* filename) {
 
@@ -42,10 +152,10 @@ size_t Bigraph<left_label_t, right_label_t>::read(const char* filename) {
   size_t edge_count(0); left_label_t left_node; right_label_t right_node;
   while(input_file >> left_node >> right_node) {
 
-    left_adjacency[left_node].insert(right_node);
-    right_adjacency[right_node].insert(left_node);
+    add_edge(left_node, right_node);
     edge_count++;
   }
+  finish();
 
   input_file.close();
   return edge_count;
@@ -56,41 +166,88 @@ size_t Bigraph<left_label_t, right_label_t>::remove_biclique(const set<left_labe
 
   size_t removed(0);
 
-  for(typename set<left_label_t>::iterator left_it = left_nodes.begin(); left_it != left_nodes.end(); left_it++)
-    for(typename set<right_label_t>::iterator right_it = right_nodes.begin(); right_it != right_nodes.end(); right_it++) {
-      left_adjacency[*left_it].erase(*right_it);
-      right_adjacency[*right_it].erase(*left_it);
-    }
+  for(typename set<left_label_t>::const_iterator left_it = left_nodes.begin(); left_it != left_nodes.end(); left_it++) {
 
-  for(typename set<left_label_t>::iterator left_it = left_nodes.begin(); left_it != left_nodes.end(); left_it++)
-    if(left_adjacency[*left_it].size() == 0) {
-      left_adjacency.erase(*left_it);
+    long i = left.find(*left_it);
+    if(i < 0 || left_removed(i)) continue;
+
+    right_label_t* row = &left.neighbours[0];
+    left.end[i] = remove_if(row + left.begin[i], row + left.end[i],
+			    [&](const right_label_t& r) { return right_nodes.count(r) > 0; }) - row;
+    if(left.end[i] == left.begin[i]) {
+      SetBit(&left.removed[0], i);
       removed++;
     }
+  }
 
-  for(typename set<right_label_t>::iterator right_it = right_nodes.begin(); right_it != right_nodes.end(); right_it++)
-    if(right_adjacency[*right_it].size() == 0) {
-      right_adjacency.erase(*right_it);
+  for(typename set<right_label_t>::const_iterator right_it = right_nodes.begin(); right_it != right_nodes.end(); right_it++) {
+
+    long i = right.find(*right_it);
+    if(i < 0 || right_removed(i)) continue;
+
+    left_label_t* row = &right.neighbours[0];
+    right.end[i] = remove_if(row + right.begin[i], row + right.end[i],
+			     [&](const left_label_t& l) { return left_nodes.count(l) > 0; }) - row;
+    if(right.end[i] == right.begin[i]) {
+      SetBit(&right.removed[0], i);
       removed++;
     }
+  }
 
   return removed;
 }
 
+// the left nodes adjacent to every one of right_nodes, sorted
+template<class left_label_t, class right_label_t>
+void Bigraph<left_label_t, right_label_t>::common_left_neighbours(const set<right_label_t>& right_nodes, vector<left_label_t>& result) const {
+
+  result.clear();
+
+  // the shortest rows first, so that the result shrinks as fast as it can
+  vector<pair<size_t, long> > by_length;
+  for(typename set<right_label_t>::const_iterator it = right_nodes.begin(); it != right_nodes.end(); it++) {
+
+    long i = right.find(*it);
+    if(i < 0) return;
+    by_length.push_back(make_pair(right.end[i] - right.begin[i], i));
+  }
+  if(by_length.empty()) return;
+  sort(by_length.begin(), by_length.end());
+
+  result.assign(right_begin(by_length[0].second), right_end(by_length[0].second));
+  vector<left_label_t> next;
+  for(size_t k = 1; k < by_length.size() && !result.empty(); k++) {
+
+    intersect_sorted(&result[0], &result[0] + result.size(), right_begin(by_length[k].second), right_end(by_length[k].second), next);
+    swap(result, next);
+  }
+}
+
+//
+// A graph whose edges carry any number of (integer) labels, kept as a single
+// array of edges and, for every label, the range of an index of (label,
+// edge) pairs that holds its edges. The bigraph of a label is only built
+// when it is asked for, so that it can be freed as soon as the label is
+// done.
+//
 template<class left_label_t, class right_label_t, class edge_label_t>
 class Labelled_Bigraphs {
 
  private:
 
-  map<edge_label_t, Bigraph<left_label_t, right_label_t> > bigraphs;
+  vector<pair<left_label_t, right_label_t> > edges;
+  vector<pair<edge_label_t, size_t> > labelled;         // sorted by finish()
+  map<edge_label_t, pair<size_t, size_t> > ranges;      // of labelled, by label
   set<edge_label_t> edge_types;
 
  public:
 
+  // read the lines "left right label..." in one pass, however many labels
+  // a line has
   void read(const char* filename) {
 
     ifstream input_file(filename);
-    
+
     if (!input_file) {
 
       cerr << "Could not read the file " << filename << endl;
@@ -98,29 +255,76 @@ class Labelled_Bigraphs {
       return;
     }
 
-    left_label_t left_node; right_label_t right_node;
-    char line[1000];
-    
-    while(input_file >> left_node >> right_node) {
+    string line;
+    while(getline(input_file, line)) {
 
-      input_file.getline(line, 1000);
-      istringstream line_stream(line);
+      const char* p = line.c_str(); char* end;
+      long left_node = strtol(p, &end, 10);
+      if(end == p) continue;
+      p = end;
+      long right_node = strtol(p, &end, 10);
+      if(end == p) continue;
+      p = end;
 
-      edge_label_t edge_type;
-      while(line_stream >> edge_type) {
-	
-	edge_types.insert(edge_type); 
-	bigraphs[edge_type].get_left_adjacency()[left_node].insert(right_node);
-	bigraphs[edge_type].get_right_adjacency()[right_node].insert(left_node);
-      }
+      size_t edge = add_edge(left_node, right_node);
+      for(long edge_type = strtol(p, &end, 10); end != p; p = end, edge_type = strtol(p, &end, 10))
+	add_label(edge, edge_type);
+
+      // an edge without labels is in no graph
+      if(labelled.empty() || labelled.back().second != edge)
+	edges.pop_back();
     }
+    finish();
 
     input_file.close();
   }
 
-  Bigraph<left_label_t, right_label_t>& getGraph(edge_label_t edge_type) { return bigraphs[edge_type]; } 
+  // edges are added, and then labels for them; finish() indexes the labels
+  size_t add_edge(const left_label_t& left_node, const right_label_t& right_node) {
+
+    edges.push_back(make_pair(left_node, right_node));
+    return edges.size() - 1;
+  }
+
+  void add_label(size_t edge, const edge_label_t& edge_type) {
+
+    edge_types.insert(edge_type); 
+    labelled.push_back(make_pair(edge_type, edge));
+  }
+
+  void finish() {
+
+    sort(labelled.begin(), labelled.end());
+    ranges.clear();
+    for(size_t i = 0; i < labelled.size(); i++) {
+
+      pair<size_t, size_t>& range = ranges[labelled[i].first];
+      if(range.second == 0) range.first = i;
+      range.second = i + 1;
+    }
+  }
+
+  size_t num_edges(const edge_label_t& edge_type) const {
+
+    typename map<edge_label_t, pair<size_t, size_t> >::const_iterator it = ranges.find(edge_type);
+    return (it == ranges.end()) ? 0 : it->second.second - it->second.first;
+  }
+
+  // build the bigraph of the edges with the label
+  Bigraph<left_label_t, right_label_t> getGraph(const edge_label_t& edge_type) const {
+
+    Bigraph<left_label_t, right_label_t> graph;
+    typename map<edge_label_t, pair<size_t, size_t> >::const_iterator it = ranges.find(edge_type);
+    if(it != ranges.end()) {
+
+      for(size_t i = it->second.first; i < it->second.second; i++)
+	graph.add_edge(edges[labelled[i].second].first, edges[labelled[i].second].second);
+      graph.finish();
+    }
+    return graph;
+  }
+
   set<edge_label_t>& getEdgeTypes() { return edge_types; }
- 
 };
 
 #endif
@@ -9,7 +9,7 @@ int main(int argc, char** argv) {
   int total = atoi(argv[2]);
   double p = atof(argv[3]);
 
-  double pval = betai(count+1, total-count, p);
+  double pval = betai_d(count+1, total-count, p);
   cout << pval << endl;
 
   return 0;
@@ -0,0 +1,93 @@
+#ifndef BITVEC_H
+#define BITVEC_H
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+//
+// Word-level helpers for bitsets stored as arrays of 64-bit words.
+//
+// The kernels are templated on the number of words W so that for small
+// bitsets the loops are fully unrolled; W = 0 means the word count is only
+// known at run time and is passed in words.
+//
+
+typedef uint64_t bitword_t;
+
+const int BITS_PER_WORD = 64;
+
+// number of words needed to hold n bits
+inline int
+WordsFor(int n)
+{
+    return (n + BITS_PER_WORD - 1) / BITS_PER_WORD;
+}
+
+inline void
+SetBit(bitword_t * a, int i)
+{
+    a[i / BITS_PER_WORD] |= bitword_t(1) << (i % BITS_PER_WORD);
+}
+
+inline bool
+TestBit(const bitword_t * a, int i)
+{
+    return (a[i / BITS_PER_WORD] >> (i % BITS_PER_WORD)) & 1;
+}
+
+inline int
+PopCount(const bitword_t * a, int words)
+{
+    int n = 0;
+    for (int i = 0; i < words; i++)
+    {
+        n += __builtin_popcountll(a[i]);
+    }
+    return n;
+}
+
+// append the positions of the set bits of a, in increasing order, to pos
+inline void
+BitPositions(const bitword_t * a, int words, vector<int> & pos)
+{
+    for (int i = 0; i < words; i++)
+    {
+        for (bitword_t w = a[i]; w != 0; w &= w - 1)
+        {
+            pos.push_back(i * BITS_PER_WORD + __builtin_ctzll(w));
+        }
+    }
+}
+
+// a 64-bit fingerprint of the words of a bitset
+inline uint64_t
+HashWords(const bitword_t * a, int words)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < words; i++)
+    {
+        // splitmix64 finalizer on every word
+        uint64_t z = a[i] + h;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        h = (h * 31) ^ z ^ (z >> 31);
+    }
+    return h;
+}
+
+// return true iff a & b is not empty
+template <int W>
+inline bool
+Intersects(const bitword_t * a, const bitword_t * b, int words = W)
+{
+    const int n = (W > 0) ? W : words;
+    bitword_t any = 0;
+    for (int i = 0; i < n; i++)
+    {
+        any |= a[i] & b[i];
+    }
+    return any != 0;
+}
+
+#endif
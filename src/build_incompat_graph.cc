@@ -2,61 +2,337 @@
 #include <list>
 #include <map>
 #include <algorithm>
+#include <unordered_map>
+#include <sstream>
+#include <atomic>
 #include "tree.h"
 #include "splits.h"
 #include "dist.h"
+#include "taxon_order.h"
 #include "options.h"
+#include "thread_pool.h"
+#include "segment.h"
+#include "build_incompat_graph.h"
 
 
 #define PROG_NAME "build_incompat_graph"
 
-typedef vector<pair<int, int> > IntEdgeList;
-
-bool use_dist_opt = true;
-bool out_pairs_opt = false;
-bool out_unlabeled_opt = false;
-bool all4tests_opt = false;
-bool max_perl_compat_opt = false; //try to be like the perl version
-double evalue_threshold = 0.01;
+GraphOptions::GraphOptions()
+    : use_dist(true),
+      out_pairs(false),
+      out_unlabeled(false),
+      all4tests(false),
+      max_perl_compat(false),
+      clade_order(false),
+      incompat_index(true),
+      pair_summaries(true),
+      threads(1),
+      evalue_threshold(0.01)
+{
+}
 
 //===========================================================================
 // Incompatability Graph
 //===========================================================================
 
-bool
-ByLex(const pair<int,int> & a, const pair<int,int> & b)
+// the pairs of splits (l, r) that are incompatible, where split l has id
+// l_id; appends the right ids, sorted, to E
+inline void
+AppendSortedEdges(int l_id, vector<int> & right_ids, IntEdgeList & E)
 {
-    return (a.first < b.first || (a.first == b.first && a.second < b.second));
+    sort(right_ids.begin(), right_ids.end());
+    for (unsigned i = 0; i < right_ids.size(); i++)
+    {
+        E.push_back(make_pair(l_id, right_ids[i]));
+    }
 }
 
+
+// the smaller side of split i if it partitions exactly the common taxa, 
+// else 0
+const bitword_t *
+SmallerSide(
+    const SplitBitsets & S,
+    int i,
+    const vector<bitword_t> & common
+    )
+{
+    for (unsigned j = 0; j < common.size(); j++)
+    {
+        if ((S.first(i)[j] | S.second(i)[j]) != common[j] ||
+            (S.first(i)[j] & S.second(i)[j]) != 0) return 0;
+    }
+    int w = S.words();
+    return (PopCount(S.first(i), w) <= PopCount(S.second(i), w)) ?
+        S.first(i) : S.second(i);
+}
+
+
 /*
- * Will create an edge list of incompatible splits between the two sets of
- * splits.
+ * An index for finding incompatible pairs without testing every pair. Let U
+ * be the taxa common to all the splits. For a split (X, U-X) and a split 
+ * (Y, U-Y), with c = |X & Y|, the four quadrants have sizes c, |X|-c, |Y|-c
+ * and |U|-|X|-|Y|+c. So if X and Y are the smaller sides, only right splits
+ * whose smaller side overlaps X can be incompatible with the left split, and
+ * they are found, with c, from per-taxon lists of the right smaller sides.
+ * Splits that don't partition exactly U (e.g. the trivial split read back
+ * from _splits) are "irregular" and are tested directly.
  */
+struct IncompatIndex
+{
+    IncompatIndex(const SplitBitsets & L, const SplitBitsets & R);
+
+    vector<bitword_t> common;       // U
+    int num_taxa;                   // |U|
+    vector<vector<int> > postings;  // taxon -> right splits
+    vector<int> right_size;         // |Y| of every regular right split
+    vector<int> irregular_right;
+};
+
+
+IncompatIndex::IncompatIndex(
+    const SplitBitsets & L,
+    const SplitBitsets & R
+    )
+{
+    int w = L.words();
+
+    // the taxa in every split
+    common.assign(w, ~bitword_t(0));
+    const SplitBitsets * dbs[2] = {&L, &R};
+    for (int k = 0; k < 2; k++)
+    {
+        for (int i = 0; i < dbs[k]->size(); i++)
+        {
+            for (int j = 0; j < w; j++)
+            {
+                common[j] &= dbs[k]->first(i)[j] | dbs[k]->second(i)[j];
+            }
+        }
+    }
+    num_taxa = PopCount(&common[0], w);
+
+    // per-taxon lists of the right splits whose smaller side has the taxon
+    postings.resize(w * BITS_PER_WORD);
+    right_size.resize(R.size());
+    vector<int> pos;
+    for (int r = 0; r < R.size(); r++)
+    {
+        const bitword_t * Y = SmallerSide(R, r, common);
+        if (!Y)
+        {
+            irregular_right.push_back(r);
+            continue;
+        }
+        pos.clear();
+        BitPositions(Y, w, pos);
+        right_size[r] = pos.size();
+        for (unsigned i = 0; i < pos.size(); i++)
+        {
+            postings[pos[i]].push_back(r);
+        }
+    }
+}
+
+
+// append the edges of left splits [begin, end) to E, in order, using the
+// index; returns the number of pairs examined
+long
+IndexedRows(
+    const IncompatIndex & index,
+    const SplitBitsets & L,
+    const SplitBitsets & R,
+    int begin,
+    int end,
+    IntEdgeList & E
+    )
+{
+    int w = L.words();
+    long examined = 0;
+
+    vector<int> overlap(R.size(), 0);
+    vector<int> touched;
+    vector<int> hits;
+    vector<int> pos;
+    for (int l = begin; l < end; l++)
+    {
+        hits.clear();
+
+        const bitword_t * X = SmallerSide(L, l, index.common);
+        if (!X)
+        {
+            examined += R.size();
+            for (int r = 0; r < R.size(); r++)
+            {
+                if (SplitBitsAreIncompatible<0>(L, l, R, r)) hits.push_back(R.id(r));
+            }
+            AppendSortedEdges(L.id(l), hits, E);
+            continue;
+        }
+
+        // count the overlap with every right split that X touches
+        pos.clear();
+        BitPositions(X, w, pos);
+        int x_size = pos.size();
+        for (unsigned t = 0; t < pos.size(); t++)
+        {
+            const vector<int> & P = index.postings[pos[t]];
+            for (unsigned j = 0; j < P.size(); j++)
+            {
+                if (overlap[P[j]]++ == 0) touched.push_back(P[j]);
+            }
+        }
+
+        examined += touched.size() + index.irregular_right.size();
+        for (unsigned j = 0; j < touched.size(); j++)
+        {
+            int r = touched[j];
+            int c = overlap[r];
+            if (x_size - c > 0 && index.right_size[r] - c > 0 &&
+                index.num_taxa - x_size - index.right_size[r] + c > 0)
+            {
+                hits.push_back(R.id(r));
+            }
+            overlap[r] = 0;
+        }
+        touched.clear();
+
+        for (unsigned j = 0; j < index.irregular_right.size(); j++)
+        {
+            int r = index.irregular_right[j];
+            if (SplitBitsAreIncompatible<0>(L, l, R, r)) hits.push_back(R.id(r));
+        }
+        AppendSortedEdges(L.id(l), hits, E);
+    }
+    return examined;
+}
+
+
+// number of splits per tile, so that a tile of left splits and a tile of
+// right splits fit in the L2 cache together
+int
+TileSize(int words)
+{
+    const int L2_BYTES = 256 * 1024;
+    return max(64, L2_BYTES / (2 * 2 * words * (int)sizeof(bitword_t)));
+}
+
+
+// append the edges of left splits [begin, end) to E, in order, by testing
+// them against tiles of right splits; W is the number of words per split
+// side (0 if not known at compile time)
+template <int W>
 void
-CreateIncompatEdgeList(
-    SplitDatabase & left_splits, 
-    SplitDatabase & right_splits,
+ScanRows(
+    const SplitBitsets & L,
+    const SplitBitsets & R,
+    int begin,
+    int end,
     IntEdgeList & E
     )
 {
-    // for every pair of splits
-    for (SplitDatabase::iterator L = left_splits.begin();
-         L != left_splits.end();
-         ++L)
+    int tile = TileSize(L.words());
+    vector<vector<int> > rows(end - begin);
+    for (int r0 = 0; r0 < R.size(); r0 += tile)
     {
-        for (SplitDatabase::iterator R = right_splits.begin();
-             R != right_splits.end();
-             ++R)
+        int r1 = min(R.size(), r0 + tile);
+        for (int l = begin; l < end; l++)
         {
-            // if the splits are incompatible, add the edge
-            if(SplitsAreIncompatible(L->first, R->first)) 
+            for (int r = r0; r < r1; r++)
             {
-                E.push_back(make_pair(L->first.id, R->first.id));
-            } 
+                // if the splits are incompatible, add the edge
+                if (SplitBitsAreIncompatible<W>(L, l, R, r))
+                {
+                    rows[l - begin].push_back(R.id(r));
+                }
+            }
         }
     }
-    sort(E.begin(), E.end(), ByLex);
+
+    // the splits are in id order, so the rows are already sorted
+    for (int l = begin; l < end; l++)
+    {
+        for (unsigned i = 0; i < rows[l - begin].size(); i++)
+        {
+            E.push_back(make_pair(L.id(l), rows[l - begin][i]));
+        }
+    }
+}
+
+
+void
+ScanRows(
+    const SplitBitsets & L,
+    const SplitBitsets & R,
+    int begin,
+    int end,
+    IntEdgeList & E
+    )
+{
+    switch (L.words())
+    {
+        case 1: ScanRows<1>(L, R, begin, end, E); break;
+        case 2: ScanRows<2>(L, R, begin, end, E); break;
+        case 3: ScanRows<3>(L, R, begin, end, E); break;
+        case 4: ScanRows<4>(L, R, begin, end, E); break;
+        case 5: ScanRows<5>(L, R, begin, end, E); break;
+        case 6: ScanRows<6>(L, R, begin, end, E); break;
+        case 7: ScanRows<7>(L, R, begin, end, E); break;
+        case 8: ScanRows<8>(L, R, begin, end, E); break;
+        default: ScanRows<0>(L, R, begin, end, E); break;
+    }
+}
+
+
+/*
+ * Will create an edge list of incompatible splits between the two sets of
+ * splits, sorted by (left id, right id). The left splits are cut into blocks
+ * that are run on pool (if not 0); every block writes its own edge list and
+ * the lists are concatenated in block order. Unless use_index, every pair of
+ * splits is tested. Returns the number of split pairs that were examined.
+ */
+long
+CreateIncompatEdgeList(
+    const SplitDatabase & left_splits, 
+    const SplitDatabase & right_splits,
+    IntEdgeList & E,
+    ThreadPool * pool,
+    bool use_index
+    )
+{
+    // pack both sides of every split into bitsets over a common taxon index
+    map<string, int> taxon_index;
+    IndexTaxa(left_splits, right_splits, taxon_index);
+    SplitBitsets L(left_splits, taxon_index);
+    SplitBitsets R(right_splits, taxon_index);
+
+    IncompatIndex * index = 0;
+    if (use_index) index = new IncompatIndex(L, R);
+
+    // small enough blocks that idle threads have something to steal
+    int threads = pool ? pool->size() : 1;
+    int block = max(1, min(TileSize(L.words()), L.size() / (8 * threads)));
+    int num_blocks = (L.size() + block - 1) / block;
+    vector<IntEdgeList> edges(num_blocks);
+    vector<long> examined(num_blocks, 0);
+
+    ParallelChunks(pool, L.size(), block, [&](long begin, long end) {
+        int b = begin / block;
+        if (index) examined[b] = IndexedRows(*index, L, R, begin, end, edges[b]);
+        else ScanRows(L, R, begin, end, edges[b]);
+    });
+
+    for (int b = 0; b < num_blocks; b++)
+    {
+        E.insert(E.end(), edges[b].begin(), edges[b].end());
+    }
+
+    if (!index) return long(L.size()) * R.size();
+
+    delete index;
+    long total = 0;
+    for (int b = 0; b < num_blocks; b++) total += examined[b];
+    return total;
 }
 
 
@@ -79,10 +355,24 @@ PrintIncompatGraph(
 // Graph Labeling Tests
 //===============================================================
 
+// 1 if the pair moved apart, -1 if it moved closer and 0 if the test failed
+inline signed char
+MovedSign(double log_pvalue, bool is_greater, long num_of_mw_tests, double evalue_threshold)
+{
+    double pval = expm1(log_pvalue)+1;
+    if (num_of_mw_tests * pval < evalue_threshold)
+    {
+        return is_greater ? 1 : -1;
+    }
+    return 0;
+}
+
+
 void
 ComputeMovedMatrix(
     DistanceMatrix & pair_distances, 
     DistanceMatrix & is_greater,  // inout
+    double evalue_threshold,
     double & ge_freq, // out
     double & le_freq  // out
     )
@@ -115,21 +405,10 @@ ComputeMovedMatrix(
             assert(pair_distances.find(M->first)!= pair_distances.end());
             assert(pair_distances[M->first].find(I->first) != 
                         pair_distances[M->first].end());
-            double pval = expm1(pair_distances[M->first][I->first])+1;
-            if(I->second && num_of_mw_tests * pval < evalue_threshold)
-            {
-                I->second = 1;
-                ge_count++;
-            }
-            else if(!I->second && num_of_mw_tests * pval < evalue_threshold)
-            {
-                I->second = -1;
-                le_count++;
-            }
-            else
-            {
-                I->second = 0;
-            }
+            I->second = MovedSign(pair_distances[M->first][I->first], 
+                I->second, num_of_mw_tests, evalue_threshold);
+            if (I->second > 0) ge_count++;
+            if (I->second < 0) le_count++;
         }
     }
 
@@ -138,99 +417,172 @@ ComputeMovedMatrix(
 }
 
 
-// create a mapping of split ids to split objects
-void
-IndexSplitsById(
-    SplitDatabase & splits,     // in
-    map<int, Split *> & index   // out
-    )
+//
+// The pair tests computed from the distance summaries of the two segments.
+// There is one test for every pair of taxa, so the number of tests is known
+// without running them.
+//
+class PairTester
 {
-    for (SplitDatabase::iterator S = splits.begin();
-         S != splits.end();
-         ++S)
+public:
+    PairTester(const DistSummaries & left, const DistSummaries & right, bool asymetric,
+            double evalue_threshold, ostream & log)
+        : _left(left), _right(right), _asymetric(asymetric), 
+          _evalue_threshold(evalue_threshold)
     {
-        // make sure id doesn't already exist
-        assert(index.find(S->first.id) == index.end());
+        DIE_IF(left.taxa() != right.taxa(), "The _dist files are for different taxa");
+        if (left.num_samples() != right.num_samples())
+        {
+            log << "warning: Different # of trees were sampled for the two segments." << endl;
+        }
+        long n = left.num_taxa();
+        _num_of_mw_tests = n * (n - 1) / 2;
+    }
+
+    const DistSummaries & summaries() const { return _left; }
+    long num_tests() const { return _num_of_mw_tests; }
 
-        index[S->first.id] = const_cast<Split*>(&(S->first));
+    // the moved sign of the pair of summary indices i < j
+    signed char Moved(int i, int j) const
+    {
+        bool is_greater;
+        double log_pvalue = ComputePValue(_left.mean(i, j), _left.sd(i, j),
+            _right.mean(i, j), _right.sd(i, j), is_greater, _asymetric);
+        return MovedSign(log_pvalue, is_greater, _num_of_mw_tests, _evalue_threshold);
     }
-}
 
+private:
+    const DistSummaries & _left;
+    const DistSummaries & _right;
+    bool _asymetric;
+    double _evalue_threshold;
+    long _num_of_mw_tests;
+};
 
-void
-AddLabel(
-    map<string, int> & labels,
-    set<string> & I, 
-    int & index
-    )
+
+//
+// The distinct candidate sets, as bitsets over the taxon index. Sets are
+// interned through a hash of their words, and the label of a set is the
+// order in which it was first seen.
+//
+class CandidateTable
 {
-    string str = SetAsString(I);
-    if(labels.find(str) == labels.end()) 
+public:
+    CandidateTable(int words) : _words(words) {}
+
+    int Intern(const bitword_t *);
+
+    int size() const { return _sizes.size(); }
+    int count(int label) const { return _sizes[label]; }
+    const vector<int> & members(int label) const { return _members[label]; }
+    const IntervalSet & runs(int label) const { return _runs[label]; }
+
+    bool SetOrder(const vector<int> &);
+
+private:
+    int _words;
+    vector<bitword_t> _bits;
+    vector<int> _sizes;
+    vector<vector<int> > _members;  // taxon indices, increasing
+    vector<IntervalSet> _runs;      // only filled under --clade-order
+    unordered_map<uint64_t, vector<int> > _buckets;
+};
+
+
+// return the label of the set, adding it if it is new
+int
+CandidateTable::Intern(const bitword_t * S)
+{
+    vector<int> & bucket = _buckets[HashWords(S, _words)];
+    for (unsigned i = 0; i < bucket.size(); i++)
     {
-        labels[str] = index;
-        index++;
+        if (equal(S, S + _words, &_bits[bucket[i] * _words])) return bucket[i];
     }
+
+    int label = size();
+    bucket.push_back(label);
+    _bits.insert(_bits.end(), S, S + _words);
+    _members.push_back(vector<int>());
+    BitPositions(S, _words, _members.back());
+    _sizes.push_back(_members.back().size());
+    return label;
 }
 
-bool 
-BySize(const set<string> & a, const set<string> & b)
+
+// store the sets as runs of an order; position maps taxon indices to their
+// place in the order, or to -1 if they are not in it, which fails
+bool
+CandidateTable::SetOrder(const vector<int> & position)
 {
-    return a.size() < b.size();
+    _runs.resize(size());
+    vector<int> pos;
+    for (int label = 0; label < size(); label++)
+    {
+        pos.clear();
+        for (unsigned i = 0; i < _members[label].size(); i++)
+        {
+            int p = position[_members[label][i]];
+            if (p < 0) return false;
+            pos.push_back(p);
+        }
+        PositionsToIntervals(pos, _runs[label]);
+    }
+    return true;
 }
 
 
+// the labels of the 4 candidate sets of an edge, sorted by size
 struct CandidateSets
 {
-    CandidateSets(
-        const set<string> & A, 
-        const set<string> & B, 
-        const set<string> & C, 
-        const set<string> & D,
-        map<string, int> & labels
-        )
+    CandidateSets(const int ids[4], const CandidateTable & table)
     {
-        // sort the candidate sets by size
-        vector<set<string> > Tmp;
-        Tmp.push_back(A);
-        Tmp.push_back(B);
-        Tmp.push_back(C);
-        Tmp.push_back(D);
-        sort(Tmp.begin(), Tmp.end(), BySize);
-
-        a = Tmp[0]; b = Tmp[1]; c = Tmp[2]; d = Tmp[3];
+        // sort the candidate sets by size, keeping ties in order
+        vector<pair<int, int> > Tmp;
+        for (int k = 0; k < 4; k++)
+        {
+            Tmp.push_back(make_pair(table.count(ids[k]), k));
+        }
+        sort(Tmp.begin(), Tmp.end());
 
-        ai = labels[SetAsString(a)];
-        bi = labels[SetAsString(b)];
-        ci = labels[SetAsString(c)];
-        di = labels[SetAsString(d)];
+        for (int k = 0; k < 4; k++)
+        {
+            labels[k] = ids[Tmp[k].second];
+            sizes[k] = Tmp[k].first;
+        }
     }
 
-    set<string> a,b,c,d;
-    long ai, bi, ci, di;
+    long label(int k) const { return labels[k]; }
+    long size(int k) const { return sizes[k]; }
+
+    long labels[4];
+    long sizes[4];
 };
 
 
 // for every edge in the incompatibility graph we construct the 4 candidate
 // sets (stored in a list of CandidateSets structs in the same order as the
-// edges in the IntEdgeList list). We also construct a mapping from each set
-// (as a string) to an integer that we will use as an id in future output.
+// edges in the IntEdgeList list). Every distinct set is interned in table,
+// which gives it the integer id that we will use in future output.
 //
 void
 ConstructCandidateSets(
-    SplitDatabase & left_splits,
-    SplitDatabase & right_splits,
+    const SplitDatabase & left_splits,
+    const SplitDatabase & right_splits,
+    const map<string, int> & taxon_index,
     IntEdgeList & IG,
-    map<string, int> & labels, // out
+    CandidateTable & table, // out
     vector<CandidateSets> & sets // out
     )
 {
-    map<int, Split*> left_index;
-    IndexSplitsById(left_splits, left_index);
+    SplitBitsets L(left_splits, taxon_index);
+    SplitBitsets R(right_splits, taxon_index);
+    int w = L.words();
 
-    map<int, Split*> right_index;
-    IndexSplitsById(right_splits, right_index);
+    map<int, int> left_row, right_row;
+    for (int i = 0; i < L.size(); i++) left_row[L.id(i)] = i;
+    for (int i = 0; i < R.size(); i++) right_row[R.id(i)] = i;
 
-    int curr_index = 0;
+    vector<bitword_t> S(w);
 
     // for every edge in the incompatibility graph
     for (IntEdgeList::iterator E = IG.begin();
@@ -238,29 +590,42 @@ ConstructCandidateSets(
          ++E)
     {
         // get the splits corresponding to this graph edge
-        Split * L = left_index[E->first];
-        Split * R = right_index[E->second];
-
-        // compute the intersection & complement
-        set<string> I1;
-        set<string> D1;
-        I1.clear(); D1.clear();
-        SetIntersection(L->first(), R->first(), I1);
-        SetDifference(L->first(), R->first(), D1);
+        int l = left_row[E->first];
+        int r = right_row[E->second];
 
-        AddLabel(labels, I1, curr_index);
-        AddLabel(labels, D1, curr_index);
+        // intersection & complement of both sides of L with R.first
+        int ids[4];
+        const bitword_t * sides[2] = {L.first(l), L.second(l)};
+        for (int k = 0; k < 2; k++)
+        {
+            for (int j = 0; j < w; j++) S[j] = sides[k][j] & R.first(r)[j];
+            ids[2 * k] = table.Intern(&S[0]);
+            for (int j = 0; j < w; j++) S[j] = sides[k][j] & ~R.first(r)[j];
+            ids[2 * k + 1] = table.Intern(&S[0]);
+        }
 
-        set<string> I2;
-        set<string> D2;
-        I2.clear(); D2.clear();
-        SetIntersection(L->second(), R->first(), I2);
-        SetDifference(L->second(), R->first(), D2);
+        sets.push_back(CandidateSets(ids, table));
+    }
+}
 
-        AddLabel(labels, I2, curr_index);
-        AddLabel(labels, D2, curr_index);
 
-        sets.push_back(CandidateSets(I1, D1, I2, D2, labels));
+// the taxa of every label, sorted by label index
+void
+NameLabels(
+    const CandidateTable & table,
+    const vector<string> & taxa,  // taxon index -> name
+    vector<string> & labels       // out
+    )
+{
+    labels.resize(table.size());
+    for (int label = 0; label < table.size(); label++)
+    {
+        const vector<int> & M = table.members(label);
+        string & L = labels[label];
+        for (unsigned i = 0; i < M.size(); i++)
+        {
+            L += ((i == 0) ? "" : " ") + taxa[M[i]];
+        }
     }
 }
 
@@ -269,164 +634,369 @@ ConstructCandidateSets(
 void
 PrintLabelMapping(
     ostream & out,
-    map<string, int> & labels
+    const LabelledGraph & graph
     )
 {
-    map<int, string> reverse;
-    for (map<string, int>::iterator L = labels.begin();
-         L != labels.end();
-         ++L)
-    {
-        reverse[L->second] = L->first;
-    }
-
-    for (map<int, string>::iterator R = reverse.begin();
-         R != reverse.end();
-         ++R)
+    for (unsigned label = 0; label < graph.labels.size(); label++)
     {
-        out << R->first << " " << R->second << endl << endl;
+        out << label << " " << graph.labels[label] << endl << endl;
     }
 }
 
 
+// Print every edge and its labels. The unfiltered graph lists all four
+// candidate sets of an edge.
 void
-PrintAllCandidates(
+PrintLabelledGraph(
     ostream & out,
-    IntEdgeList & IG,
-    vector<CandidateSets> & candidates
+    const LabelledGraph & graph
     )
 {
-    // for every edge in the incompatibility graph
-    int i = 0;
-    for (IntEdgeList::iterator E = IG.begin();
-         E != IG.end();
-         ++E, ++i)
+    for (long i = 0; i < (long)graph.edges.size(); i++)
     {
-        out << E->first << " " << E->second << " ";
-        CandidateSets abcd = candidates[i];
-
-        out << abcd.ai << " " << abcd.bi << " " 
-            << abcd.ci << " " << abcd.di << " " << endl;
+        out << graph.edges[i].first << " " << graph.edges[i].second << " ";
+        for (int k = 0; k < 4; k++)
+        {
+            if (!graph.has_label(i, k)) continue;
+            out << graph.candidate(i, k);
+            if (k < 3 || graph.all_candidates) out << " ";
+        }
+        out << '\n';
     }
+    out.flush();
 }
 
 
-// return an item from the distance matrix,
-// handling the symmetry of (a,b) and (b,a)
-double
-MovedItem(
+//
+// The moved matrix over the taxon index: 1, -1 or 0 for every pair of taxa,
+// as computed by ComputeMovedMatrix, or by running the pair tests on the
+// distance summaries.
+//
+class MovedMatrix
+{
+public:
+    MovedMatrix(DistanceMatrix &, const map<string, int> &);
+    MovedMatrix(const PairTester &, const vector<string> &, ThreadPool *, double &, double &);
+
+    const signed char * row(int a) const { return &_m[(long)a * _n]; }
+
+    static const signed char MISSING = 2;
+
+private:
+    long _n;
+    vector<signed char> _m;
+};
+
+
+MovedMatrix::MovedMatrix(
     DistanceMatrix & moved_matrix,
-    const string & a,
-    const string & b
+    const map<string, int> & taxon_index
     )
+    : _n(taxon_index.size()), _m(_n * _n, MISSING)
 {
-    if (moved_matrix.find(a) != moved_matrix.end()) 
+    for (DistanceMatrix::iterator M = moved_matrix.begin();
+         M != moved_matrix.end();
+         ++M)
     {
-        if (moved_matrix[a].find(b) != moved_matrix[a].end()) 
+        map<string, int>::const_iterator A = taxon_index.find(M->first);
+        DIE_IF(A == taxon_index.end(), "Taxon " + M->first + " is in _dist but not in _splits");
+        for (map<string, double>::iterator I = M->second.begin();
+             I != M->second.end();
+             ++I)
         {
-            return moved_matrix[a][b];
+            map<string, int>::const_iterator B = taxon_index.find(I->first);
+            DIE_IF(B == taxon_index.end(), "Taxon " + I->first + " is in _dist but not in _splits");
+            _m[A->second * _n + B->second] = _m[B->second * _n + A->second] = 
+                (signed char)I->second;
         }
     }
+}
 
-    if (moved_matrix.find(b) != moved_matrix.end())
+
+// run the test of every pair of taxa in the summaries, in chunks of rows on
+// pool (if not 0), and return the same frequencies as ComputeMovedMatrix.
+// The frequencies need every test, so each is run once, here.
+MovedMatrix::MovedMatrix(
+    const PairTester & tester,
+    const vector<string> & taxa,   // taxon index -> name
+    ThreadPool * pool,
+    double & ge_freq, // out
+    double & le_freq  // out
+    )
+    : _n(taxa.size()), _m(_n * _n, MISSING)
+{
+    // summary index -> taxon index, or -1 for a taxon in no split
+    const DistSummaries & summaries = tester.summaries();
+    int n = summaries.num_taxa();
+    vector<long> taxon(n, -1);
+    for (unsigned t = 0; t < taxa.size(); t++)
     {
-        if (moved_matrix[b].find(a) != moved_matrix[b].end())
+        int i = summaries.index(taxa[t]);
+        if (i >= 0) taxon[i] = t;
+    }
+
+    atomic<long> ge_count(0), le_count(0);
+    ParallelChunks(pool, n, 16, [&](long begin, long end) {
+        long ge = 0, le = 0;
+        for (long i = begin; i < end; i++)
         {
-            return moved_matrix[b][a];
+            for (int j = i + 1; j < n; j++)
+            {
+                signed char m = tester.Moved(i, j);
+                if (m > 0) ge++;
+                if (m < 0) le++;
+                if (taxon[i] >= 0 && taxon[j] >= 0)
+                {
+                    _m[taxon[i] * _n + taxon[j]] = _m[taxon[j] * _n + taxon[i]] = m;
+                }
+            }
         }
-    }
-    assert(false);
+        ge_count += ge;
+        le_count += le;
+    });
+
+    ge_freq = ((float)ge_count) / tester.num_tests();
+    le_freq = ((float)le_count) / tester.num_tests();
 }
 
-extern "C" { float betai(float, float, float); }
 
+extern "C" { double betai_d(double, double, double); }
+
+//
+// The binomial tail P(X > count) for X ~ Bin(n, freq), where freq is fixed
+// for a pair of segments. n = |A| * |B| takes few distinct values and many
+// set pairs share a count, so the tails are memoized by (count, n). The memo
+// is shared by the labelling threads and split into shards with their own
+// locks, like the ComparisonCache; a shard is emptied when it fills.
+//
+class BinomialTail
+{
+public:
+    explicit BinomialTail(double freq) : _freq(freq) {}
+
+    double Pval(long count, long n);
+
+private:
+    static const int NUM_SHARDS = 64;
+    static const size_t SHARD_SIZE = 1 << 10;
+
+    typedef pair<long, long> Key;
+
+    struct Shard
+    {
+        mutex lock;
+        map<Key, double> memo;
+    };
+
+    double Tail(long count, long n);
+
+    Shard & shard(const Key & key)
+    {
+        return _shards[(key.first * 31 + key.second) % NUM_SHARDS];
+    }
+
+    double _freq;
+    Shard _shards[NUM_SHARDS];
+};
+
+
+// 1 if count is not above the expected count
 double
-GetBinPval(long count, long n, double freq)
+BinomialTail::Pval(long count, long n)
 {
-    if( ((double)count) / n > freq) 
+    if (((double)count) / n > _freq)
     {
-        return betai(count+1, n - count, freq);
+        return Tail(count, n);
     }
     return 1.0;
 }
 
 
+double
+BinomialTail::Tail(long count, long n)
+{
+    Key key = make_pair(count, n);
+    Shard & S = shard(key);
+    {
+        lock_guard<mutex> guard(S.lock);
+        map<Key, double>::iterator P = S.memo.find(key);
+        if (P != S.memo.end()) return P->second;
+    }
+
+    double pval = betai_d(count + 1, n - count, _freq);
+
+    lock_guard<mutex> guard(S.lock);
+    if (S.memo.size() >= SHARD_SIZE) S.memo.clear();
+    S.memo[key] = pval;
+    return pval;
+}
+
+
+// what is needed to test candidate sets for movement
+struct MovedStats
+{
+    const MovedMatrix * moved;
+    const MovedRangeSums * range_sums;  // only under --clade-order
+    BinomialTail * ge_tail;
+    BinomialTail * le_tail;
+    const GraphOptions * options;
+};
+
+
+// The result of comparing two candidate sets. The same pair of labels occurs
+// on many edges, so results are cached by (smaller label, larger label); the
+// counts are symmetric in the two sets.
+struct SetComparison
+{
+    long ge_count, le_count;
+    double ge_pval, le_pval;
+};
+
+
+//
+// The cache of set comparisons, shared by the threads that label edges. It
+// is split into shards with their own locks so that lookups rarely wait.
+// Two threads may both compute a missing comparison; the results are equal
+// and the first one is kept. A shard that fills up is emptied, so the cache
+// stays small however many labels there are; a comparison that was dropped
+// is just computed again.
+//
+class ComparisonCache
+{
+public:
+    typedef pair<long, long> Key;
+
+    ComparisonCache() : _computed(0) {}
+
+    bool Find(const Key & key, SetComparison & result)
+    {
+        Shard & S = shard(key);
+        lock_guard<mutex> guard(S.lock);
+        map<Key, SetComparison>::iterator C = S.results.find(key);
+        if (C == S.results.end()) return false;
+        result = C->second;
+        return true;
+    }
+
+    void Insert(const Key & key, const SetComparison & result)
+    {
+        Shard & S = shard(key);
+        lock_guard<mutex> guard(S.lock);
+        if (S.results.size() >= SHARD_SIZE) S.results.clear();
+        if (S.results.insert(make_pair(key, result)).second) _computed++;
+    }
+
+    // the number of comparisons that were computed
+    long computed() const { return _computed; }
+
+private:
+    static const int NUM_SHARDS = 64;
+    static const size_t SHARD_SIZE = 1 << 14;
+
+    struct Shard
+    {
+        mutex lock;
+        map<Key, SetComparison> results;
+    };
+
+    Shard & shard(const Key & key)
+    {
+        return _shards[(key.first * 31 + key.second) % NUM_SHARDS];
+    }
+
+    Shard _shards[NUM_SHARDS];
+    atomic<long> _computed;
+};
+
+
+// compare the candidate sets with labels a and b; if stats.range_sums is
+// given, the counts come from the interval representations of the sets
 void
 CompareSets(
-    set<string> & a,
-    set<string> & b,
-    DistanceMatrix & moved_matrix,
-    double ge_freq,
-    double le_freq,
+    const CandidateTable & table,
+    long a,
+    long b,
+    const MovedStats & stats,
+    ComparisonCache & cache,
 
     double & ge_pval,  // out
     double & le_pval   // out
     )
 {
+    ComparisonCache::Key key = make_pair(min(a, b), max(a, b));
+    SetComparison result;
+    if (cache.Find(key, result))
+    {
+        ge_pval = result.ge_pval;
+        le_pval = result.le_pval;
+        return;
+    }
+
     long ge_count, le_count;
     ge_count = le_count = 0;
 
-    for (set<string>::iterator A = a.begin();
-         A != a.end();
-         ++A)
+    if (stats.range_sums)
     {
-        for(set<string>::iterator B = b.begin();
-            B != b.end();
-            ++B)
+        stats.range_sums->Count(table.runs(a), table.runs(b), ge_count, le_count);
+    }
+    else
+    {
+        const vector<int> & A = table.members(a);
+        const vector<int> & B = table.members(b);
+        for (unsigned i = 0; i < A.size(); i++)
         {
-            double mi = MovedItem(moved_matrix, *A, *B);
-            if (mi < 0)
-            {
-                le_count += 1;
-            }
-            if (mi > 0)
+            const signed char * row = stats.moved->row(A[i]);
+            for (unsigned j = 0; j < B.size(); j++)
             {
-                ge_count += 1;
+                signed char mi = row[B[j]];
+                assert(mi != MovedMatrix::MISSING);
+                if (mi < 0)
+                {
+                    le_count += 1;
+                }
+                if (mi > 0)
+                {
+                    ge_count += 1;
+                }
             }
         }
     }
 
-    long n = a.size() * b.size();
+    long n = (long)table.count(a) * table.count(b);
 
-    ge_pval = GetBinPval(ge_count, n, ge_freq);
-    le_pval = GetBinPval(le_count, n, le_freq);
+    ge_pval = stats.ge_tail->Pval(ge_count, n);
+    le_pval = stats.le_tail->Pval(le_count, n);
 
-    //char tmp[1024];
-    //sprintf(tmp, "(%ld, %ld, %f, %f ,,, %ld, %ld, %f, %f)\n",
-    //        ge_count, n, ge_freq, ge_pval, 
-    //        le_count, n, le_freq, le_pval);
-    //cout << tmp;
+    result.ge_count = ge_count;
+    result.le_count = le_count;
+    result.ge_pval = ge_pval;
+    result.le_pval = le_pval;
+    cache.Insert(key, result);
 }
 
 
-// tests whether set a has moved relative to one of the other sets
+// tests whether candidate set k has moved relative to one of the other sets
 bool
 TestCandidate(
-    set<string> & a,
-    set<string> & b,
-    set<string> & c,
-    set<string> & d,
-
-    DistanceMatrix & moved_matrix,
-    double ge_freq,
-    double le_freq
+    const CandidateTable & table,
+    CandidateSets & abcd,
+    int k,
+    const MovedStats & stats,
+    ComparisonCache & cache
     )
 {
-    vector<set<string>*> others;
-    others.push_back(&b);
-    others.push_back(&c);
-    others.push_back(&d);
-
     double greater, lesser;
     greater = lesser = 0;
 
-    for (vector<set<string>*>::iterator I = others.begin();
-         I != others.end();
-         ++I)
+    for (int j = 0; j < 4; j++)
     {
+        if (j == k) continue;
+
         double ge_pval, le_pval;
-        CompareSets(a, **I, moved_matrix, ge_freq, le_freq, ge_pval, le_pval);
+        CompareSets(table, abcd.label(k), abcd.label(j), stats, cache, 
+            ge_pval, le_pval);
 
+        double evalue_threshold = stats.options->evalue_threshold;
         if (ge_pval < evalue_threshold) {
             greater += (le_pval < evalue_threshold) ? 0.5 : 1.0;
         }
@@ -439,53 +1009,66 @@ TestCandidate(
 }
 
 
+// label edges [begin, end) with the candidate sets that moved
 void
-PrintFilteredLabeledGraph(
-    ostream & out,
-    IntEdgeList & IG,
+LabelEdges(
+    vector<unsigned char> & moved, // out
+    const CandidateTable & table,
     vector<CandidateSets> & candidates,
-    DistanceMatrix & moved_matrix,
-    double ge_freq,
-    double le_freq
+    const MovedStats & stats,
+    ComparisonCache & cache,
+    long begin,
+    long end
     )
 {
-    // for every edge in the incompatibility graph
-    int i = 0;
-    for (IntEdgeList::iterator E = IG.begin();
-         E != IG.end();
-         ++E, ++i)
+    const GraphOptions & opts = *stats.options;
+    for (long i = begin; i < end; i++)
     {
-        out << E->first << " " << E->second << " ";
-        CandidateSets abcd = candidates[i];
-
-        if(TestCandidate(abcd.a, abcd.b, abcd.c, abcd.d, moved_matrix, ge_freq, le_freq)) 
-        {
-            out << abcd.ai << " ";
-        }
-        if(TestCandidate(abcd.b, abcd.a, abcd.c, abcd.d, moved_matrix, ge_freq, le_freq)) 
+        CandidateSets & abcd = candidates[i];
+        unsigned char bits = 0;
+        for (int k = 0; k < 3; k++)
         {
-            out << abcd.bi << " ";
-        }
-        if(TestCandidate(abcd.c, abcd.a, abcd.b, abcd.d, moved_matrix, ge_freq, le_freq)) 
-        {
-            out << abcd.ci << " ";
+            if(TestCandidate(table, abcd, k, stats, cache)) bits |= 1 << k;
         }
 
         // we do the test on the largest set if requested or if the "largest" set
         // is the same size as the 3rd largest.
-        
-        if(!max_perl_compat_opt && (all4tests_opt || abcd.d.size() == abcd.c.size())) 
+        if(!opts.max_perl_compat && (opts.all4tests || abcd.size(3) == abcd.size(2))) 
         {
-            if(TestCandidate(abcd.d, abcd.a, abcd.b, abcd.c, moved_matrix, ge_freq, le_freq)) 
-            {
-                out << abcd.di;
-            }
+            if(TestCandidate(table, abcd, 3, stats, cache)) bits |= 1 << 3;
         }
-        out << endl;
+        moved[i] = bits;
     }
 }
 
 
+/*
+ * Test the candidate sets of every edge and keep the ones that moved as the
+ * labels of the edge. The edges are labelled in chunks on pool (if not 0).
+ */
+void
+LabelFilteredGraph(
+    LabelledGraph & graph,  // out
+    const CandidateTable & table,
+    vector<CandidateSets> & candidates,
+    const MovedStats & stats,
+    ThreadPool * pool,
+    ostream & log
+    )
+{
+    ComparisonCache cache;
+
+    graph.all_candidates = false;
+    graph.moved.assign(candidates.size(), 0);
+    ParallelChunks(pool, candidates.size(), 4096, [&](long begin, long end) {
+        LabelEdges(graph.moved, table, candidates, stats, cache, begin, end);
+    });
+
+    log << PROG_NAME ": tested " << cache.computed() << " pairs of candidate sets."
+         << endl;
+}
+
+
 //===================================================================================
 // Main Program
 //===================================================================================
@@ -494,7 +1077,8 @@ PrintFilteredLabeledGraph(
 
 const char *GRAPH_OPTIONS = "h";
 
-enum {GRAPH_DIST_OPT=1, GRAPH_BAD_OPT, OUT_PAIRS_OPT, OUT_UNLABELED_OPT, ALL4TESTS_OPT, VER09_OPT};
+enum {GRAPH_DIST_OPT=1, GRAPH_BAD_OPT, OUT_PAIRS_OPT, OUT_UNLABELED_OPT, ALL4TESTS_OPT, VER09_OPT,
+      CLADE_ORDER_OPT, INCOMPAT_INDEX_OPT, THREADS_OPT, PAIR_SUMMARIES_OPT};
 
 static struct option MAYBE_UNUSED graph_long_options[] = {
     {"use-dist", 1, 0, GRAPH_DIST_OPT},
@@ -503,11 +1087,15 @@ static struct option MAYBE_UNUSED graph_long_options[] = {
     {"debug-out-unlabeled", 0, 0, OUT_UNLABELED_OPT},
     {"test-all-candidates", 1, 0, ALL4TESTS_OPT},
     {"version-0.9-compat", 0, 0, VER09_OPT},
+    {"clade-order", 1, 0, CLADE_ORDER_OPT},
+    {"incompat-index", 1, 0, INCOMPAT_INDEX_OPT},
+    {"threads", 1, 0, THREADS_OPT},
+    {"pair-summaries", 1, 0, PAIR_SUMMARIES_OPT},
     {0,0,0,0}
 };
 
 void
-GraphUsage(bool show_cmd=true)
+GraphUsage(bool show_cmd)
 {
     if(show_cmd)
     {
@@ -524,15 +1112,19 @@ GraphUsage(bool show_cmd=true)
     }
 
     cerr << "   --test-all-candidates=[0,1] : if 1, test even large candidate sets (default 0)" << endl 
+         << "   --clade-order=[0,1]   : if 1, count moved pairs over clade-ordered intervals (default 0)" << endl
+         << "   --incompat-index=[0,1] : if 0, test every pair of splits for incompatibility (default 1)" << endl
+         << "   --threads=N           : use N threads to build and label the graph (default 1)" << endl
+         << "   --pair-summaries=[0,1] : if 0, test the taxon pairs through name-keyed maps (default 1)" << endl
          << "   --debug-out-pairs     : output result of statistical tests (debugging only)" << endl
          << "   --debug-out-unlabeled : output unlabeled incompat graph (debugging only)" << endl
          << endl;
     if(show_cmd) exit(3);
 }
 
-static
+// parse the options into opts; returns the index of the first argument
 int
-ProcessOptions(int argc, char *argv[])
+ParseGraphOptions(int argc, char *argv[], GraphOptions & opts)
 {
     bool ignore_bad_opt = false;
     int a;
@@ -546,12 +1138,16 @@ ProcessOptions(int argc, char *argv[])
         switch(a)
         {
             case 'h': GraphUsage(); break;
-            case GRAPH_DIST_OPT: use_dist_opt = (bool)atoi(optarg); break;
+            case GRAPH_DIST_OPT: opts.use_dist = (bool)atoi(optarg); break;
             case GRAPH_BAD_OPT: ignore_bad_opt = true; opterr=0; break;
-            case OUT_PAIRS_OPT: out_pairs_opt = true; break;
-            case OUT_UNLABELED_OPT: out_unlabeled_opt = true; break;
-            case ALL4TESTS_OPT: all4tests_opt = (bool)atoi(optarg); break;
-            case VER09_OPT: max_perl_compat_opt = true; break;
+            case OUT_PAIRS_OPT: opts.out_pairs = true; break;
+            case OUT_UNLABELED_OPT: opts.out_unlabeled = true; break;
+            case ALL4TESTS_OPT: opts.all4tests = (bool)atoi(optarg); break;
+            case VER09_OPT: opts.max_perl_compat = true; break;
+            case CLADE_ORDER_OPT: opts.clade_order = (bool)atoi(optarg); break;
+            case INCOMPAT_INDEX_OPT: opts.incompat_index = (bool)atoi(optarg); break;
+            case THREADS_OPT: opts.threads = max(1, atoi(optarg)); break;
+            case PAIR_SUMMARIES_OPT: opts.pair_summaries = (bool)atoi(optarg); break;
             default:
                 if(!ignore_bad_opt) {
                     cerr << "Unknown option." << endl;
@@ -559,73 +1155,58 @@ ProcessOptions(int argc, char *argv[])
                 }
         }
     }
-    if (optind+2 >= argc) GraphUsage();
     return optind;
 }
 
 
 void
-CheckInFile(istream & in, const string & name)
-{
-    if (!in) {
-        cerr << PROG_NAME ": Can't find file " << name << endl;
-        exit(3);
-    }
-}
-
-
-int
-main_build_incompat_graph(int argc, char * argv[])
+IncompatGraphBuilder::Run(
+    SegmentData & left,
+    SegmentData & right,
+    const string & outbase,
+    ostream & log,
+    LabelledGraph * result  // if not 0, keep the graph here
+    ) const
 {
-    cout << PROG_NAME ": built on " << __DATE__ << endl;
+    const string & base1 = left.base();
+    const string & base2 = right.base();
 
-    // read the command line
-    int first_base_index = ProcessOptions(argc, argv);
-    string base1 = argv[first_base_index];
-    string base2 = argv[first_base_index + 1];
-    string outbase = argv[first_base_index + 2];
-
-    cout << PROG_NAME ": Use Distance = " << use_dist_opt << endl;
-    cout << PROG_NAME ": In Files = " << base1 << " " << base2 << endl;
-    cout << PROG_NAME ": Out Base = " << outbase << endl;
-    if(max_perl_compat_opt) 
+    log << PROG_NAME ": Use Distance = " << _options.use_dist << endl;
+    log << PROG_NAME ": In Files = " << base1 << " " << base2 << endl;
+    log << PROG_NAME ": Out Base = " << outbase << endl;
+    if(_options.max_perl_compat) 
     {
-        cout << PROG_NAME 
+        log << PROG_NAME 
              << ": Trying to be as simlar to GIRAF Version 0.9 as possible." 
              << endl;
     }
 
     // read the splits
-    cout << PROG_NAME ": reading left splits." << endl;
+    log << PROG_NAME ": reading left splits." << endl;
     string tmp;
-    tmp = base1 + "_splits";
-    ifstream left_splits_file(tmp.c_str());
-    CheckInFile(left_splits_file, tmp);
-    SplitDatabase left_splits; 
-    ReadSplitsMapping(left_splits_file, left_splits); 
-    left_splits_file.close();
-    cout << PROG_NAME ": found " << left_splits.size() << " left splits." 
+    const SplitDatabase & left_splits = left.splits();
+    log << PROG_NAME ": found " << left_splits.size() << " left splits." 
          << endl;
 
-    cout << PROG_NAME ": reading right splits." << endl;
-    tmp = base2 + "_splits";
-    ifstream right_splits_file(tmp.c_str());
-    CheckInFile(right_splits_file, tmp);
-    SplitDatabase right_splits;
-    ReadSplitsMapping(right_splits_file, right_splits);
-    right_splits_file.close();
-    cout << PROG_NAME ": found " << right_splits.size() << " right splits." 
+    log << PROG_NAME ": reading right splits." << endl;
+    const SplitDatabase & right_splits = right.splits();
+    log << PROG_NAME ": found " << right_splits.size() << " right splits." 
          << endl;
 
     // Construct the incompatible split list
-    cout << PROG_NAME ": finding incompatible splits." << endl;
+    log << PROG_NAME ": finding incompatible splits." << endl;
+    ThreadPool * own_pool = (!_pool && _options.threads > 1) ? new ThreadPool(_options.threads) : 0;
+    ThreadPool * pool = _pool ? _pool : own_pool;
     IntEdgeList IG;
-    CreateIncompatEdgeList(left_splits, right_splits, IG);
+    long examined = CreateIncompatEdgeList(left_splits, right_splits, IG, pool,
+        _options.incompat_index);
+    log << PROG_NAME ": examined " << examined << " of " 
+         << long(left_splits.size()) * right_splits.size() << " split pairs." << endl;
 
     // Write out the incompatibility graph
-    if (out_unlabeled_opt) 
+    if (_options.out_unlabeled) 
     {
-        cout << PROG_NAME ": writing incompatibility graph." << endl;
+        log << PROG_NAME ": writing incompatibility graph." << endl;
         tmp = outbase + "_graph";
         ofstream outgraph(tmp.c_str());
         PrintIncompatGraph(outgraph, IG);
@@ -633,52 +1214,71 @@ main_build_incompat_graph(int argc, char * argv[])
     }
     
     // get the candidates implied by the incompatibile splits
-    cout << PROG_NAME ": getting candidate taxa sets." << endl;
-    map<string, int> labels;
+    log << PROG_NAME ": getting candidate taxa sets." << endl;
+    map<string, int> taxon_index;
+    IndexTaxa(left_splits, right_splits, taxon_index);
+    vector<string> taxa(taxon_index.size());
+    for (map<string, int>::iterator T = taxon_index.begin(); T != taxon_index.end(); ++T)
+    {
+        taxa[T->second] = T->first;
+    }
+    CandidateTable table(WordsFor(taxa.size()));
     vector<CandidateSets> candidates;
-    ConstructCandidateSets(left_splits, right_splits, IG, labels, candidates);
-    tmp = outbase + "_graph.labels";
-    ofstream graph_labels(tmp.c_str());
-    PrintLabelMapping(graph_labels, labels);
-    graph_labels.close();
+    ConstructCandidateSets(left_splits, right_splits, taxon_index, IG, table, candidates);
+    LabelledGraph local_graph;
+    LabelledGraph & graph = result ? *result : local_graph;
+    NameLabels(table, taxa, graph.labels);
 
     // compute the labels for every edge
-    cout << PROG_NAME ": computing labelled graph." << endl;
-    tmp = outbase + "_graph.labelled";
-    ofstream new_graph(tmp.c_str());
-    if(!use_dist_opt)
+    log << PROG_NAME ": computing labelled graph." << endl;
+    if(!_options.use_dist)
     {
         // if user asked to not filter
-        PrintAllCandidates(new_graph, IG, candidates);
+        graph.all_candidates = true;
+        graph.moved.assign(candidates.size(), 0xf);
+    }
+    else if (_options.pair_summaries && !_options.out_pairs && !_options.clade_order)
+    {
+        // test the taxon pairs straight from the distance summaries
+        log << PROG_NAME ": reading distance summaries." << endl;
+        PairTester tester(left.distances(log), right.distances(log), _options.max_perl_compat,
+            _options.evalue_threshold, log);
+
+        log << PROG_NAME ": calculating distance statistics." << endl;
+        double ge_freq, le_freq;
+        MovedStats stats;
+        stats.moved = new MovedMatrix(tester, taxa, pool, ge_freq, le_freq);
+        stats.ge_tail = new BinomialTail(ge_freq);
+        stats.le_tail = new BinomialTail(le_freq);
+        stats.range_sums = 0;
+        stats.options = &_options;
+
+        log << PROG_NAME ": labelling graph." << endl;
+        LabelFilteredGraph(graph, table, candidates, stats, pool, log);
+        delete stats.moved;
+        delete stats.ge_tail;
+        delete stats.le_tail;
     }
     else
     {
-        // read the distances & compute the pair-test results
-        cout << PROG_NAME ": computing pair distances." << endl;
-        tmp = base1 + "_dist";
-        ifstream left_dist_file(tmp.c_str());
-        CheckInFile(left_dist_file, tmp);
-        tmp = base2 + "_dist";
-        ifstream right_dist_file(tmp.c_str());
-        CheckInFile(right_dist_file, tmp);
+        // compute the pair-test results
+        log << PROG_NAME ": computing pair distances." << endl;
 
         // output pair_test_file if requested (only for backward compat)
         ofstream *pair_test_file = 0;
-        if (out_pairs_opt)
+        if (_options.out_pairs)
         {
             tmp = outbase + "_pair_test_results"; 
             pair_test_file = new ofstream(tmp.c_str());
         }
         DistanceMatrix pair_distances;
         DistanceMatrix is_greater;
-        cout << PROG_NAME ": ";
-        ComputePairDistances(left_dist_file, right_dist_file, max_perl_compat_opt,
-            pair_test_file, pair_distances, is_greater);
-        cout << endl;
-
-        // close up the files
-        left_dist_file.close();
-        right_dist_file.close();
+        log << PROG_NAME ": ";
+        ComputePairDistances(left.distances(log), right.distances(log), _options.max_perl_compat,
+            pair_test_file, pair_distances, is_greater, log);
+        log << endl;
+
+        // close up the file
         if(pair_test_file) 
         {
             pair_test_file->close();
@@ -686,14 +1286,96 @@ main_build_incompat_graph(int argc, char * argv[])
         }
 
         // compute the pairs that seemed to have moved
-        cout << PROG_NAME ": calculating distance statistics." << endl;
+        log << PROG_NAME ": calculating distance statistics." << endl;
         double ge_freq, le_freq;
-        ComputeMovedMatrix(pair_distances, is_greater, ge_freq, le_freq); 
+        ComputeMovedMatrix(pair_distances, is_greater, _options.evalue_threshold, 
+            ge_freq, le_freq); 
+
+        MovedStats stats;
+        stats.ge_tail = new BinomialTail(ge_freq);
+        stats.le_tail = new BinomialTail(le_freq);
+        stats.moved = new MovedMatrix(is_greater, taxon_index);
+
+        stats.options = &_options;
+
+        // optionally lay the taxa out so that candidate sets are few runs
+        stats.range_sums = 0;
+        if (_options.clade_order && !IG.empty())
+        {
+            log << PROG_NAME ": ordering taxa by the left consensus tree." << endl;
+            map<int, int> counts;
+            for (map<int, set<int> >::const_iterator T = left.trees().begin();
+                 T != left.trees().end();
+                 ++T)
+            {
+                counts[T->first] = T->second.size();
+            }
 
-        cout << PROG_NAME ": writing graph." << endl;
-        PrintFilteredLabeledGraph(new_graph, IG, candidates, 
-            is_greater, ge_freq, le_freq);
+            vector<string> order;
+            ConsensusLeafOrder(left_splits, counts, left.num_trees(), order);
+            TaxonOrder taxon_order(order);
+            vector<int> position(taxa.size(), -1);
+            for (unsigned t = 0; t < taxa.size(); t++)
+            {
+                if (taxa[t] != "") position[t] = taxon_order.position(taxa[t]);
+            }
+            MovedRangeSums * range_sums = new MovedRangeSums;
+            if (!range_sums->Build(taxon_order, is_greater) ||
+                !table.SetOrder(position))
+            {
+                cout << PROG_NAME ": taxa don't fit the clade order; "
+                     << "comparing candidate sets pair by pair." << endl;
+                delete range_sums;
+                range_sums = 0;
+            }
+            stats.range_sums = range_sums;
+        }
+
+        log << PROG_NAME ": labelling graph." << endl;
+        LabelFilteredGraph(graph, table, candidates, stats, pool, log);
+        delete stats.range_sums;
+        delete stats.moved;
+        delete stats.ge_tail;
+        delete stats.le_tail;
     }
-    new_graph.close();
+    delete own_pool;
+
+    graph.candidates.resize(4 * candidates.size());
+    for (unsigned i = 0; i < candidates.size(); i++)
+    {
+        for (int k = 0; k < 4; k++) graph.candidates[4 * i + k] = candidates[i].label(k);
+    }
+    graph.edges.swap(IG);
+
+    if (!result)
+    {
+        log << PROG_NAME ": writing graph." << endl;
+        tmp = outbase + "_graph.labels";
+        ofstream graph_labels(tmp.c_str());
+        PrintLabelMapping(graph_labels, graph);
+        graph_labels.close();
+
+        tmp = outbase + "_graph.labelled";
+        ofstream new_graph(tmp.c_str());
+        PrintLabelledGraph(new_graph, graph);
+        new_graph.close();
+    }
+}
+
+
+int
+main_build_incompat_graph(int argc, char * argv[])
+{
+    cout << PROG_NAME ": built on " << __DATE__ << endl;
+
+    // read the command line
+    GraphOptions options;
+    int first_base_index = ParseGraphOptions(argc, argv, options);
+    if (first_base_index+2 >= argc) GraphUsage();
+
+    SegmentCache segments;
+    IncompatGraphBuilder builder(options);
+    builder.Run(segments.Get(argv[first_base_index]), 
+        segments.Get(argv[first_base_index + 1]), argv[first_base_index + 2], cout);
     return 0;
 }
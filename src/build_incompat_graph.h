@@ -0,0 +1,59 @@
+#ifndef BUILD_INCOMPAT_GRAPH_H
+#define BUILD_INCOMPAT_GRAPH_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include "splits.h"
+#include "segment.h"
+#include "labelled_graph.h"
+#include "thread_pool.h"
+
+// The edges (left split id, right split id) of an incompatibility graph
+typedef vector<pair<int, int> > IntEdgeList;
+
+long CreateIncompatEdgeList(const SplitDatabase &, const SplitDatabase &, IntEdgeList &, 
+    ThreadPool *, bool);
+
+// The options of build_incompat_graph
+struct GraphOptions
+{
+    GraphOptions();
+
+    bool use_dist;
+    bool out_pairs;
+    bool out_unlabeled;
+    bool all4tests;
+    bool max_perl_compat;   // try to be like the perl version
+    bool clade_order;
+    bool incompat_index;
+    bool pair_summaries;    // test the taxon pairs from the distance summaries
+    int threads;
+    double evalue_threshold;
+};
+
+int ParseGraphOptions(int, char **, GraphOptions &);
+void GraphUsage(bool = true);
+
+
+//
+// Builds the labelled incompatibility graph of a pair of segments and writes
+// it to <outbase>_graph.labels and <outbase>_graph.labelled, or keeps it in
+// a LabelledGraph if one is given. The builder keeps no state between runs,
+// so it can run several pairs at once. With --threads, the work of a run goes
+// on the given pool, which the runs share, or else on a pool of its own.
+//
+class IncompatGraphBuilder
+{
+public:
+    explicit IncompatGraphBuilder(const GraphOptions & options, ThreadPool * pool = 0) 
+        : _options(options), _pool(pool) {}
+
+    void Run(SegmentData &, SegmentData &, const string &, ostream &, 
+        LabelledGraph * = 0) const;
+
+private:
+    GraphOptions _options;
+    ThreadPool * _pool;
+};
+
+#endif
@@ -1,6 +1,11 @@
 #include <sstream>
 #include <vector>
 #include <cmath>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
 #include "dist.h"
 #include "util.h"
 #include "tree.h"
@@ -58,10 +63,11 @@ DebugPrintVector(const vector<double> & vec)
     }
 }
 
+// the test on the means and standard deviations of the two distance vectors
 double
 ComputePValue(
-    const vector<double> & dist1, 
-    const vector<double> & dist2,
+    double avg1, double sd1,
+    double avg2, double sd2,
     bool & is_greater,
     bool asymetric
     )
@@ -71,12 +77,11 @@ ComputePValue(
     // asymetric=true is for is for perl compatibility
     if(!asymetric) 
     {
-        z_score = (Average(dist1)-Average(dist2)) / 
-                   max(StdDev(dist1),StdDev(dist2));
+        z_score = (avg1-avg2) / max(sd1,sd2);
     }
     else
     {
-        z_score = (Average(dist1)-Average(dist2)) / StdDev(dist2);
+        z_score = (avg1-avg2) / sd2;
     }
     double corr_z_score = 2.0 * sqrt(z_score*z_score); 
 
@@ -86,6 +91,19 @@ ComputePValue(
 }
 
 
+double
+ComputePValue(
+    const vector<double> & dist1, 
+    const vector<double> & dist2,
+    bool & is_greater,
+    bool asymetric
+    )
+{
+    return ComputePValue(Average(dist1), StdDev(dist1), Average(dist2), StdDev(dist2),
+        is_greater, asymetric);
+}
+
+
 // parse a line formated as "T1 T2 dist1 dist2 ..."
 void
 ParseDistLine(
@@ -108,67 +126,272 @@ ParseDistLine(
 }
 
 
-// scan in1 and in2 _dist files and produce a pair_test_results file
+// test every pair of taxa on the summaries of the two segments and produce a
+// pair_test_results file
 void
 ComputePairDistances(
-    istream & in1,
-    istream & in2,
+    const DistSummaries & left,
+    const DistSummaries & right,
     bool asymetric, // FALSE for normal; TRUE for perl compat
     ostream * out, // 0 if no output file
     DistanceMatrix & D,   // out
-    DistanceMatrix & G    // out
+    DistanceMatrix & G,   // out
+    ostream & log         // progress and warnings
     )
 {
-    string line1, line2;
-    string taxon1, taxon2;
-    string check1, check2;
-    vector<double> distvec1, distvec2;
-
-    long count = 0;
-    unsigned long linenum = 0;
-    unsigned long size1=0, size2=0;
+    DIE_IF(left.taxa() != right.taxa(), "The _dist files are for different taxa");
 
-    while(getline(in1, line1))
+    // the two files can have different length vectors, but this is
+    // suspicious
+    if (left.num_samples() != right.num_samples())
     {
-        getline(in2, line2);
-        linenum++;
-
-        ParseDistLine(line1, taxon1, taxon2, distvec1);
-        ParseDistLine(line2, check1, check2, distvec2);
+        log << "warning: Different # of trees were sampled for the two segments." << endl;
+    }
 
-        assert(taxon1 == check1 && taxon2 == check2);
-        if(linenum == 1)
+    long count = 0;
+    const vector<string> & taxa = left.taxa();
+    for (int i = 0; i < left.num_taxa(); i++)
+    {
+        for (int j = i + 1; j < left.num_taxa(); j++)
         {
-            // save the size to check later
-            size1 = distvec1.size();
-            size2 = distvec2.size();
-
-            // the two files can have different length vectors, but 
-            // this is suspicious
-            if (size1 != size2)
+            bool is_greater;
+            double log_pvalue = ComputePValue(left.mean(i, j), left.sd(i, j), 
+                right.mean(i, j), right.sd(i, j), is_greater, asymetric);
+            if (out)
             {
-                cout << "warning: Different # of trees were sampled for the two segments." << endl;
+                (*out) << taxa[i] << " " << taxa[j] << " " << (is_greater?1:0) 
+                       << " " << log_pvalue << endl;
             }
+
+            D[taxa[i]][taxa[j]] = log_pvalue;
+            G[taxa[i]][taxa[j]] = is_greater;
+
+            if(count++ % 1000 == 0) log << "." << flush;
+        }
+    }
+}
+
+
+//===========================================================================
+// Distance summaries
+//===========================================================================
+
+const char DISTSUM_MAGIC[8] = {'G','I','R','D','S','U','M','1'};
+
+struct DistSumHeader
+{
+    char magic[8];
+    int64_t num_taxa;
+    int64_t num_samples;
+    int64_t names_offset;   // the names follow the pairs, '\0' terminated
+    int64_t names_size;
+};
+
+
+// Summarize the _dist lines read from in into the file named out. The lines
+// must be in the order PrintDistances writes them.
+void
+WriteDistSummaries(
+    istream & in,
+    const string & out_name
+    )
+{
+    // write to a temporary file that replaces out_name when complete
+    ostringstream tmp_name;
+    tmp_name << out_name << ".tmp" << getpid();
+    ofstream out(tmp_name.str().c_str(), ios::binary);
+    DIE_IF(!out, "Can't write " + tmp_name.str());
+
+    DistSumHeader H;
+    memcpy(H.magic, DISTSUM_MAGIC, sizeof(H.magic));
+    H.num_taxa = H.num_samples = 0;
+    out.write((const char *)&H, sizeof(H));
+
+    // the first taxon is paired with every other one in the first lines
+    string line, taxon1, taxon2;
+    vector<double> distvec;
+    vector<string> taxa;
+    int i = 0, j = 1;
+    while(getline(in, line))
+    {
+        ParseDistLine(line, taxon1, taxon2, distvec);
+        if (taxa.empty())
+        {
+            taxa.push_back(taxon1);
+            H.num_samples = distvec.size();
+        }
+        if (i == 0 && taxon1 == taxa[0])
+        {
+            taxa.push_back(taxon2);
         }
-        else
+        else if (j == (int)taxa.size())
+        {
+            i++;
+            j = i + 1;
+        }
+        DIE_IF(j >= (int)taxa.size() || taxon1 != taxa[i] || taxon2 != taxa[j], 
+            "Taxon pairs in _dist are not in the expected order");
+        DIE_IF((long)distvec.size() != H.num_samples,
+            "Vectors in _dist files are not all the same length!");
+
+        double summary[2] = {Average(distvec), StdDev(distvec)};
+        out.write((const char *)summary, sizeof(summary));
+        j++;
+    }
+    DIE_IF(!taxa.empty() && (i != (int)taxa.size() - 2 || j != (int)taxa.size()),
+        "The _dist file does not hold every pair of taxa");
+
+    H.num_taxa = taxa.size();
+    H.names_offset = out.tellp();
+    for (unsigned t = 0; t < taxa.size(); t++)
+    {
+        out.write(taxa[t].c_str(), taxa[t].size() + 1);
+    }
+    H.names_size = (long)out.tellp() - H.names_offset;
+    out.seekp(0);
+    out.write((const char *)&H, sizeof(H));
+    out.close();
+    DIE_IF(!out, "Error writing " + tmp_name.str());
+
+    DIE_IF(rename(tmp_name.str().c_str(), out_name.c_str()) != 0, 
+        "Can't rename " + tmp_name.str() + " to " + out_name);
+}
+
+
+// true if a was modified after b
+static bool
+Newer(const struct stat & a, const struct stat & b)
+{
+    if (a.st_mtim.tv_sec != b.st_mtim.tv_sec) return a.st_mtim.tv_sec > b.st_mtim.tv_sec;
+    return a.st_mtim.tv_nsec > b.st_mtim.tv_nsec;
+}
+
+
+DistSummaries::DistSummaries(const string & base, ostream & log)
+    : _data(0), _size(0), _num_samples(0), _pairs(0)
+{
+    string dist_name = base + "_dist";
+    string sum_name = base + "_distsum";
+
+    struct stat dist_stat, sum_stat;
+    bool have_dist = (stat(dist_name.c_str(), &dist_stat) == 0);
+    bool have_sum = (stat(sum_name.c_str(), &sum_stat) == 0);
+    DIE_IF(!have_dist && !have_sum, "Can't find file " + dist_name);
+
+    if (!have_sum || (have_dist && !Newer(sum_stat, dist_stat)))
+    {
+        log << "summarizing " << dist_name << "." << endl;
+        ifstream in(dist_name.c_str());
+        DIE_IF(!in, "Can't read " + dist_name);
+        WriteDistSummaries(in, sum_name);
+    }
+    Map(sum_name);
+}
+
+
+// the distance between taxa a < b in M, which holds a pair under the smaller
+// taxon; PrintDistances writes a pair missing from a tree as 0
+static bool
+FindDistance(const DistanceMatrix & M, const string & a, const string & b, double & d)
+{
+    DistanceMatrix::const_iterator I = M.find(a);
+    if (I == M.end()) return false;
+    map<string, double>::const_iterator J = I->second.find(b);
+    if (J == I->second.end()) return false;
+    d = J->second;
+    return true;
+}
+
+
+// the summaries of the distances of every tree, as they would be read back
+// from the _dist file PrintDistances writes
+DistSummaries::DistSummaries(const vector<DistanceMatrix> & matrices)
+    : _data(0), _size(0), _num_samples(matrices.size()), _pairs(0)
+{
+    if (matrices.empty()) return;
+
+    set<string> taxa;
+    for (DistanceMatrix::const_iterator I = matrices[0].begin();
+        I != matrices[0].end();
+        ++I)
+    {
+        taxa.insert(I->first);
+        for (map<string, double>::const_iterator J = I->second.begin();
+            J != I->second.end();
+            ++J)
         {
-            // make sure vectors in each file are the same size
-            DIE_IF(distvec1.size() != size1 || distvec2.size() != size2,
-                "Vectors in _dist files are not all the same length!");
+            taxa.insert(J->first);
         }
+    }
+    for (set<string>::iterator T = taxa.begin(); T != taxa.end(); ++T)
+    {
+        _index[*T] = _taxa.size();
+        _taxa.push_back(*T);
+    }
 
-        bool is_greater;
-        double log_pvalue = ComputePValue(distvec1, distvec2, is_greater, asymetric);
-        if (out)
+    vector<double> distvec(matrices.size());
+    for (int i = 0; i < num_taxa(); i++)
+    {
+        for (int j = i + 1; j < num_taxa(); j++)
         {
-            (*out) << taxon1 << " " << taxon2 << " " << (is_greater?1:0) 
-                   << " " << log_pvalue << endl;
-                   //<< " " << StdDev(dist1) << " " << StdDev(dist2) << endl;
+            DIE_IF(!FindDistance(matrices[0], _taxa[i], _taxa[j], distvec[0]),
+                "The distance matrices do not hold every pair of taxa");
+            for (unsigned k = 1; k < matrices.size(); k++)
+            {
+                if (!FindDistance(matrices[k], _taxa[i], _taxa[j], distvec[k]))
+                {
+                    distvec[k] = 0;
+                }
+            }
+            _owned.push_back(Average(distvec));
+            _owned.push_back(StdDev(distvec));
         }
+    }
+    if (!_owned.empty()) _pairs = &_owned[0];
+}
 
-        D[taxon1][taxon2] = log_pvalue;
-        G[taxon1][taxon2] = is_greater;
 
-        if(count++ % 1000 == 0) cout << "." << flush;
+DistSummaries::~DistSummaries()
+{
+    if (_data) munmap(_data, _size);
+}
+
+
+void
+DistSummaries::Map(const string & name)
+{
+    int fd = open(name.c_str(), O_RDONLY);
+    DIE_IF(fd < 0, "Can't read " + name);
+    struct stat st;
+    DIE_IF(fstat(fd, &st) != 0, "Can't read " + name);
+    _size = st.st_size;
+    DIE_IF(_size < sizeof(DistSumHeader), name + " is not a distance summary file");
+    _data = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    DIE_IF(_data == MAP_FAILED, "Can't map " + name);
+
+    const DistSumHeader * H = (const DistSumHeader *)_data;
+    long n = H->num_taxa;
+    DIE_IF(memcmp(H->magic, DISTSUM_MAGIC, sizeof(H->magic)) != 0 ||
+           H->names_offset != (long)sizeof(DistSumHeader) + n * (n - 1) * 8 ||
+           (long)_size != H->names_offset + H->names_size,
+           name + " is not a distance summary file");
+
+    _num_samples = H->num_samples;
+    _pairs = (const double *)((const char *)_data + sizeof(DistSumHeader));
+    const char * names = (const char *)_data + H->names_offset;
+    for (long t = 0; t < n; t++)
+    {
+        _taxa.push_back(names);
+        _index[_taxa.back()] = t;
+        names += _taxa.back().size() + 1;
     }
 }
+
+
+int
+DistSummaries::index(const string & taxon) const
+{
+    map<string, int>::const_iterator I = _index.find(taxon);
+    return (I == _index.end()) ? -1 : I->second;
+}
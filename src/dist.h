@@ -4,7 +4,56 @@
 #include <fstream>
 #include "tree.h"
 
-void ComputePairDistances(istream &, istream &, bool, ostream *, DistanceMatrix &,
-        DistanceMatrix &);
+double ComputePValue(double, double, double, double, bool &, bool);
+
+
+//
+// The mean and standard deviation of the distances of every taxon pair in a
+// _dist file. They are kept in a binary <base>_distsum file that is mapped
+// into memory, and rebuilt from <base>_dist when missing or older than it.
+// Taxa are numbered in sorted order; pairs (i, j) with i < j are stored in
+// the order of the _dist lines; rebuilding the file is noted on log. The
+// summaries can also be computed from the distance matrices of the trees
+// directly, without any files.
+//
+class DistSummaries
+{
+public:
+    DistSummaries(const string & base, ostream & log);
+    explicit DistSummaries(const vector<DistanceMatrix> &);
+    ~DistSummaries();
+
+    int num_taxa() const { return _taxa.size(); }
+    long num_samples() const { return _num_samples; }
+    const vector<string> & taxa() const { return _taxa; }
+
+    // -1 if the taxon is not in the _dist file
+    int index(const string &) const;
+
+    // i < j
+    double mean(int i, int j) const { return _pairs[2 * pair(i, j)]; }
+    double sd(int i, int j) const { return _pairs[2 * pair(i, j) + 1]; }
+
+private:
+    long pair(int i, int j) const 
+    { 
+        return (long)i * (2 * num_taxa() - i - 1) / 2 + (j - i - 1); 
+    }
+
+    void Map(const string &);
+
+    void * _data;
+    size_t _size;
+    long _num_samples;
+    const double * _pairs;
+    vector<double> _owned;      // the summaries, if not mapped
+    vector<string> _taxa;
+    map<string, int> _index;
+};
+
+void WriteDistSummaries(istream &, const string &);
+
+void ComputePairDistances(const DistSummaries &, const DistSummaries &, bool, ostream *, 
+        DistanceMatrix &, DistanceMatrix &, ostream &);
 
 #endif
@@ -3,38 +3,50 @@
 #include <fstream>
 #include <vector>
 #include <cmath>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 
 #include "label_types.h" 
 #include "bigraph.h"
 #include "scored_set.h"
-int non_star = 1;
 #include "mica.h"
 #include "timer.h"
 #include "options.h"
+#include "thread_pool.h"
+#include "extract_reassortments.h"
 
 #define PROG_NAME "extract_reassortments"
 
 using namespace std;
 
-double threshold_opt = 0.70;
-bool require_multiple_cliques = true;
+ExtractOptions::ExtractOptions()
+    : non_star(1), threshold(0.70), require_multiple_cliques(true), threads(1),
+      mica_max_sets(0), mica_max_seconds(0), top_k(0)
+{
+}
 
 // Options for extract_reassortments
 
 const char *EXTRACT_OPTIONS = "ht:";
 
-enum {TYPE_OPT=1, THRESHOLD_OPT, SINGLE_OPT, EXTRACT_BAD_OPT};
+enum {TYPE_OPT=1, THRESHOLD_OPT, SINGLE_OPT, EXTRACT_THREADS_OPT,
+      MAX_SETS_OPT, MAX_SECONDS_OPT, TOP_K_OPT, EXTRACT_BAD_OPT};
 
 static struct option MAYBE_UNUSED extract_long_options[] = {
     {"non-star", 1, 0, TYPE_OPT},
     {"threshold", 1, 0, THRESHOLD_OPT},
     {"single", 0, 0, SINGLE_OPT},
+    {"threads", 1, 0, EXTRACT_THREADS_OPT},
+    {"mica-max-sets", 1, 0, MAX_SETS_OPT},
+    {"mica-max-seconds", 1, 0, MAX_SECONDS_OPT},
+    {"top-k", 1, 0, TOP_K_OPT},
     {"ignore-bad-options", 0, 0, EXTRACT_BAD_OPT},
     {0,0,0,0}
 };
 
 void
-ExtractUsage(bool show_cmd=true)
+ExtractUsage(bool show_cmd)
 {
     if(show_cmd)
     {
@@ -46,13 +58,22 @@ ExtractUsage(bool show_cmd=true)
     cerr << "   --non-star=[0,1] : If 1, only consider non-star bicliques (default)" << endl
          //<< "          2 for just edges" << endl
          << "   --threshold=F    : confidence cutoff (default F=0.50)" << endl
-         << "   --single         : allow single cliques" << endl;
-    if(show_cmd) exit(3);
+         << "   --single         : allow single cliques" << endl
+         << "   --mica-max-sets=N     : stop the search of a label at N sets (default no limit)" << endl
+         << "   --mica-max-seconds=F  : stop the search of a label after F seconds (default no limit)" << endl
+         << "   --top-k=K             : only report the K most confident candidates (default all)" << endl;
+    if(show_cmd)
+    {
+        // giraf lists --threads with the options of build_incompat_graph
+        cerr << "   --threads=N      : use N threads to search for bicliques (default 1)" << endl;
+        exit(3);
+    }
 }
 
 
+// parse the options into opts; returns the index of the first argument
 int
-ProcessOptions(int argc, char *argv[])
+ParseExtractOptions(int argc, char *argv[], ExtractOptions & opts)
 {
     bool ignore_bad_opt = false;
     // these are required to resuse getopt
@@ -66,9 +87,13 @@ ProcessOptions(int argc, char *argv[])
         switch(a)
         {
             case 'h': ExtractUsage(); break;
-            case TYPE_OPT: non_star = atoi(optarg); break;
-            case 't': case THRESHOLD_OPT: threshold_opt = sqrt(atof(optarg)); break;
-            case SINGLE_OPT: require_multiple_cliques = false; break;
+            case TYPE_OPT: opts.non_star = atoi(optarg); break;
+            case 't': case THRESHOLD_OPT: opts.threshold = sqrt(atof(optarg)); break;
+            case SINGLE_OPT: opts.require_multiple_cliques = false; break;
+            case EXTRACT_THREADS_OPT: opts.threads = max(1, atoi(optarg)); break;
+            case MAX_SETS_OPT: opts.mica_max_sets = max(0L, atol(optarg)); break;
+            case MAX_SECONDS_OPT: opts.mica_max_seconds = max(0.0, atof(optarg)); break;
+            case TOP_K_OPT: opts.top_k = max(0, atoi(optarg)); break;
             case EXTRACT_BAD_OPT: ignore_bad_opt = true; opterr = 0; break;
             default:
                 if(!ignore_bad_opt) {
@@ -77,39 +102,20 @@ ProcessOptions(int argc, char *argv[])
                 }
         }
     }
-    if (optind+3 >= argc) ExtractUsage();
     return optind;
 }
 
 
+// the confidence that a label is a reassortment, from its bicliques
 double
 GetConfidenceScore(
-    const string & results,
-    int & num_cliques
+    const vector<biclique<left_label_t, right_label_t> > & bicliques
     )
 {
-    istringstream iss(results);
-
     double pval = 1.0;
-    num_cliques = 0;
-
-    string line;
-    while(iss)
+    for (unsigned i = 0; i < bicliques.size(); i++)
     {
-        getline(iss, line);
-        getline(iss, line);
-        getline(iss, line);
-
-        if(iss) {
-            istringstream liness(line);
-            double pa, pb;
-            liness >> pa >> pb;
-
-            pval *= (1-pa*pb);
-            num_cliques++;
-
-            getline(iss, line);
-        }
+        pval *= (1 - bicliques[i].left_score * bicliques[i].right_score);
     }
     return 1.0 - pval;
 }
@@ -134,40 +140,37 @@ ReadLabelMapping(
 }
 
 
-void
-initialize_global_variables()
-{
-    num_of_left_trees = 0;
-    num_of_right_trees = 0;
-    left_trees.clear();
-    right_trees.clear();
-}
-
-
 vector<string>
-main_extract_reassortments(int argc, char** argv)
+ReassortmentExtractor::Run(
+    SegmentData & left,
+    SegmentData & right,
+    const string & jointbase,
+    const string & outbase,
+    ostream & log,
+    const LabelledGraph * graph  // if not 0, use it instead of the graph files
+    ) const
 {
-    // parse the command line
-    cout << PROG_NAME ": built on " << __DATE__ << endl;
-    initialize_global_variables();
-    int base_index = ProcessOptions(argc, argv);
-
-    string base1 = argv[base_index];
-    string base2 = argv[base_index+1];
-    string jointbase = argv[base_index+2];
-    string outbase = argv[base_index+3];
-
     // list the values of the options
-    cout << PROG_NAME ": Biclique Type = " << non_star << endl;
-    cout << PROG_NAME ": SquareRoot(Threshold) = " << threshold_opt << endl;
-    cout << PROG_NAME ": MultipleCliques = " << require_multiple_cliques << endl;
-
-    // Open the output files
-    ofstream results((outbase + "_bicliques").c_str());
-    if(!results) 
+    log << PROG_NAME ": Biclique Type = " << _options.non_star << endl;
+    log << PROG_NAME ": SquareRoot(Threshold) = " << _options.threshold << endl;
+    log << PROG_NAME ": MultipleCliques = " << _options.require_multiple_cliques << endl;
+    if(_options.mica_max_sets) log << PROG_NAME ": MaxSets = " << _options.mica_max_sets << endl;
+    if(_options.mica_max_seconds) log << PROG_NAME ": MaxSeconds = " << _options.mica_max_seconds << endl;
+    if(_options.top_k) log << PROG_NAME ": TopK = " << _options.top_k << endl;
+
+    // Open the output files; the bicliques are only written with the graph
+    // files
+    ofstream results_file;
+    ostream no_results(0);
+    ostream & results = graph ? no_results : results_file;
+    if(!graph)
     {
-        cerr << PROG_NAME ": Error in opening results file." << endl;
-        exit(3);
+        results_file.open((outbase + "_bicliques").c_str());
+        if(!results_file) 
+        {
+            cerr << PROG_NAME ": Error in opening results file." << endl;
+            exit(3);
+        }
     }
 
     ofstream report((outbase + "_report").c_str());
@@ -179,64 +182,225 @@ main_extract_reassortments(int argc, char** argv)
     report << "<<GiRaF Report>>" << endl << endl;
     report.precision(15);
 
-    // read the trees & graph
+    // the trees & graph
     Labelled_Bigraphs<left_label_t, right_label_t, edge_label_t> graphs;
 
-    read_trees((base1 + "_trees").c_str(), num_of_left_trees, left_trees);
-    read_trees((base2 + "_trees").c_str(), num_of_right_trees, right_trees);
-    graphs.read((jointbase + "_graph.labelled").c_str());
-
-    // read a mapping between labels and sets
+    mica_context ctx;
+    ctx.non_star = _options.non_star;
+    ctx.num_of_left_trees = left.num_trees();
+    ctx.left_trees = &left.tree_bits();
+    ctx.num_of_right_trees = right.num_trees();
+    ctx.right_trees = &right.tree_bits();
+    ThreadPool * own_pool = (!_pool && _options.threads > 1) ? new ThreadPool(_options.threads) : 0;
+    ctx.pool = _pool ? _pool : own_pool;
+    ctx.max_sets = _options.mica_max_sets;
+    ctx.max_seconds = _options.mica_max_seconds;
+
+    // the mapping between labels and sets
     map<edge_label_t, string> Labels;
-    ifstream label_map_file((jointbase + "_graph.labels").c_str());
-    ReadLabelMapping(label_map_file, Labels);
-    label_map_file.close();
+    if(graph)
+    {
+        for(long e = 0; e < (long)graph->edges.size(); e++)
+        {
+            size_t edge = graphs.add_edge(graph->edges[e].first, graph->edges[e].second);
+            for(int k = 0; k < 4; k++)
+            {
+                if(graph->has_label(e, k))
+                {
+                    graphs.add_label(edge, graph->candidate(e, k));
+                }
+            }
+        }
+        graphs.finish();
+        for(unsigned label = 0; label < graph->labels.size(); label++)
+        {
+            Labels[label] = graph->labels[label];
+        }
+    }
+    else
+    {
+        graphs.read((jointbase + "_graph.labelled").c_str());
+
+        ifstream label_map_file((jointbase + "_graph.labels").c_str());
+        ReadLabelMapping(label_map_file, Labels);
+        label_map_file.close();
+    }
 
-    // for every label, find the maximal bicliques
+    // for every label, find the maximal bicliques. The labels are searched
+    // on the pool, largest first so that a big label doesn't start last,
+    // and each one into its own buffer; the buffers are written in order.
+    // The graph of a label only exists while it is searched.
+    vector<edge_label_t> labels(graphs.getEdgeTypes().begin(), graphs.getEdgeTypes().end());
+    vector<pair<size_t, size_t> > by_size;
+    for(size_t k = 0; k < labels.size(); k++)
+    {
+        by_size.push_back(make_pair(graphs.num_edges(labels[k]), k));
+    }
+    sort(by_size.begin(), by_size.end(), 
+        [](const pair<size_t, size_t> & a, const pair<size_t, size_t> & b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+
+    // with --top-k, the labels are searched by their bound on the confidence
+    // instead, highest first, and the labels that can't be candidates not at
+    // all. The K best candidates so far are kept ordered by (-conf, index);
+    // once a label's bound can't beat the last of them, neither can the
+    // bound of any label after it.
+    bool top_k = _options.top_k > 0 && _options.non_star != 2;
+    vector<double> bound(labels.size(), 0);
+    set<pair<double, size_t> > best;
+    mutex best_lock;
+    if(top_k)
+    {
+        ParallelChunks(ctx.pool, labels.size(), 16, [&](long begin, long end) {
+            for(long k = begin; k < end; k++)
+            {
+                Bigraph<left_label_t, right_label_t> label_graph = graphs.getGraph(labels[k]);
+                bound[k] = confidence_bound<left_label_t, right_label_t, tree_label_t>(
+                    label_graph, ctx, _options.threshold, _options.require_multiple_cliques
+                );
+            }
+        });
+
+        by_size.clear();
+        for(size_t k = 0; k < labels.size(); k++)
+        {
+            if(bound[k] >= 0) by_size.push_back(make_pair(graphs.num_edges(labels[k]), k));
+        }
+        sort(by_size.begin(), by_size.end(), 
+            [&](const pair<size_t, size_t> & a, const pair<size_t, size_t> & b) {
+                return bound[a.second] > bound[b.second] || 
+                    (bound[a.second] == bound[b.second] && a.second < b.second);
+            });
+    }
+
+    vector<string> edges(labels.size());
+    vector<vector<biclique<left_label_t, right_label_t> > > bicliques(labels.size());
+    vector<size_t> num_sets(labels.size());
+    vector<char> truncated(labels.size(), 0);
+    atomic<size_t> next(0), searched(0);
+    int workers = ctx.pool ? ctx.pool->size() : 1;
+    ParallelChunks(ctx.pool, workers, 1, [&](long, long) {
+        for(size_t i = next++; i < by_size.size(); i = next++)
+        {
+            size_t k = by_size[i].second;
+            if(top_k)
+            {
+                lock_guard<mutex> hold(best_lock);
+                if((int)best.size() == _options.top_k && 
+                   !(make_pair(-bound[k], k) < *best.rbegin())) break;
+            }
+            searched++;
+
+            Bigraph<left_label_t, right_label_t> label_graph = graphs.getGraph(labels[k]);
+            if(_options.non_star == 2)
+            {
+                ostringstream output;
+                good_edges<left_label_t, right_label_t, tree_label_t>(
+                    label_graph, ctx, _options.threshold, output
+                );
+                edges[k] = output.str();
+            }
+            else
+            {
+                bool stopped = false;
+                num_sets[k] = mica<left_label_t, right_label_t, tree_label_t>(
+                    label_graph, ctx, _options.threshold, bicliques[k], cerr, &stopped
+                );
+                truncated[k] = stopped;
+            }
+
+            if(top_k && !bicliques[k].empty() && 
+               (!_options.require_multiple_cliques || bicliques[k].size() > 1))
+            {
+                lock_guard<mutex> hold(best_lock);
+                best.insert(make_pair(-GetConfidenceScore(bicliques[k]), k));
+                if((int)best.size() > _options.top_k) best.erase(--best.end());
+            }
+        }
+    });
+
+    // with --top-k, only the labels of the K best candidates are written
+    vector<char> reported(labels.size(), !top_k);
+    for(set<pair<double, size_t> >::iterator it = best.begin(); it != best.end(); it++)
+    {
+        reported[it->second] = 1;
+    }
+    if(top_k)
+    {
+        log << PROG_NAME ": Searched " << searched << " of " << labels.size() 
+            << " labels for the top " << _options.top_k << endl;
+    }
 
     // tracks the sets of taxa we output
     vector<string> found_sets;
 
-    for(set<edge_label_t>::iterator it = graphs.getEdgeTypes().begin();
-        it != graphs.getEdgeTypes().end(); it++) {
+    for(size_t k = 0; k < labels.size(); k++) {
 
-        ostringstream output;
+        if(!reported[k]) continue;
+        edge_label_t label = labels[k];
+        results << edges[k];
 
-        if(non_star == 2)
+        // a label whose search hit a limit is flagged even without bicliques
+        if(truncated[k])
         {
-            good_edges<left_label_t, right_label_t, tree_label_t>(
-                graphs.getGraph(*it), threshold_opt, results
-            );
-        }
-        else
-        {
-            mica<left_label_t, right_label_t, tree_label_t>(
-                graphs.getGraph(*it), threshold_opt, output, cerr
-            );
+            log << PROG_NAME ": Label " << label << " truncated after " 
+                << num_sets[k] << " sets" << endl;
+            report << "Truncated = ID: " << label 
+                   << ", Sets: " << num_sets[k]
+                   << ", Taxa: {" << Labels[label] << "}"
+                   << endl;
         }
 
-        if(!output.str().empty()) 
+        // the bicliques are only formatted for the _bicliques file
+        if(results_file.is_open() && (!bicliques[k].empty() || truncated[k]))
         {
-            results << "Label: " << *it << endl << endl << output.str() << endl;
+            results << "Label: " << label << endl << endl;
+            print_bicliques(bicliques[k], results);
+            results << endl;
+            if(truncated[k])
+            {
+                results << "Truncated: the search stopped after " << num_sets[k] 
+                        << " sets" << endl;
+            }
             results << "------------" << endl;
+        }
 
-            int num_cliques;
-            double conf = GetConfidenceScore(output.str(), num_cliques);
+        if(!bicliques[k].empty()) 
+        {
+            int num_cliques = bicliques[k].size();
+            double conf = GetConfidenceScore(bicliques[k]);
 
-            if ((!require_multiple_cliques) || num_cliques > 1)
+            if ((!_options.require_multiple_cliques) || num_cliques > 1)
             {
-                report << "Candidate = ID: " << *it 
+                report << "Candidate = ID: " << label 
                        << ", Conf: " << conf
-                       << ", Taxa: {" << Labels[*it] << "}"
+                       << ", Taxa: {" << Labels[label] << "}"
                        << endl;
-                found_sets.push_back(Labels[*it]);
+                found_sets.push_back(Labels[label]);
             }
         }
     }
 
-    results.close();
+    results_file.close();
     report.close();
+    delete own_pool;
 
     return found_sets;
 }
 
+
+vector<string>
+main_extract_reassortments(int argc, char** argv)
+{
+    // parse the command line
+    cout << PROG_NAME ": built on " << __DATE__ << endl;
+    ExtractOptions options;
+    int base_index = ParseExtractOptions(argc, argv, options);
+    if (base_index+3 >= argc) ExtractUsage();
+
+    SegmentCache segments;
+    ReassortmentExtractor extractor(options);
+    return extractor.Run(segments.Get(argv[base_index]), segments.Get(argv[base_index+1]),
+        argv[base_index+2], argv[base_index+3], cout);
+}
@@ -0,0 +1,51 @@
+#ifndef EXTRACT_REASSORTMENTS_H
+#define EXTRACT_REASSORTMENTS_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include "segment.h"
+#include "labelled_graph.h"
+#include "thread_pool.h"
+
+// The options of extract_reassortments
+struct ExtractOptions
+{
+    ExtractOptions();
+
+    int non_star;                   // 0 all, 1 non-star bicliques, 2 edges
+    double threshold;               // square root of the confidence cutoff
+    bool require_multiple_cliques;
+    int threads;                    // threads for the biclique search
+    long mica_max_sets;             // limits on the search of a label; 0 for none
+    double mica_max_seconds;
+    int top_k;                      // report only the K most confident labels; 0 for all
+};
+
+int ParseExtractOptions(int, char **, ExtractOptions &);
+void ExtractUsage(bool = true);
+
+
+//
+// Finds the maximal bicliques of every label of the labelled graph of a pair
+// of segments, writing them to <outbase>_bicliques and the candidates they
+// support to <outbase>_report. The graph is read from the <jointbase>_graph
+// files unless it is given in memory, in which case the bicliques are not
+// written. The extractor keeps no state between runs, so it can run several
+// pairs at once. With --threads, the search goes on the given pool, which the
+// runs share, or else on a pool of its own.
+//
+class ReassortmentExtractor
+{
+public:
+    explicit ReassortmentExtractor(const ExtractOptions & options, ThreadPool * pool = 0) 
+        : _options(options), _pool(pool) {}
+
+    vector<string> Run(SegmentData &, SegmentData &, const string &, const string &,
+        ostream &, const LabelledGraph * = 0) const;
+
+private:
+    ExtractOptions _options;
+    ThreadPool * _pool;
+};
+
+#endif
@@ -254,4 +254,75 @@ float betai(float a, float b, float x) {
     return 1.0-bt*betacf(b,a,1.0-x)/b;
 }
 
+/* Double precision versions of betacf() and betai(). betai_d(a, b, x) is the
+ * regularized incomplete beta function I_x(a, b), so betai_d(k+1, n-k, p) is
+ * the probability of more than k successes in n trials of probability p.
+ * The continued fraction needs about sqrt(max(a, b)) iterations to converge,
+ * hence the larger iteration limit. */
+
+#define MAXIT_D 100000
+#define EPS_D 1.0e-15
+#define FPMIN_D 1.0e-300
+
+double betacf_d(double a, double b, double x) {
+
+  int m,m2;
+  double aa,c,d,del,h,qab,qam,qap;
+  qab=a+b;
+  qap=a+1.0;
+  qam=a-1.0;
+  c=1.0;
+  d=1.0-qab*x/qap;
+
+  if (fabs(d) < FPMIN_D) d=FPMIN_D;
+
+  d=1.0/d;
+  h=d;
+  for (m=1;m<=MAXIT_D;m++) {
+
+    m2=2*m;
+    aa=m*(b-m)*x/((qam+m2)*(a+m2));
+    d=1.0+aa*d;
+    
+    if (fabs(d) < FPMIN_D) d=FPMIN_D;
+    c=1.0+aa/c;
+    if (fabs(c) < FPMIN_D) c=FPMIN_D;
+
+    d=1.0/d;
+    h *= d*c;
+    aa = -(a+m)*(qab+m)*x/((a+m2)*(qap+m2));
+    d=1.0+aa*d; 
+
+    if (fabs(d) < FPMIN_D) d=FPMIN_D;
+    c=1.0+aa/c;
+    if (fabs(c) < FPMIN_D) c=FPMIN_D;
+
+    d=1.0/d;
+    del=d*c;
+    h *= del;
+
+    if (fabs(del-1.0) < EPS_D) break;
+  }
+
+  if (m > MAXIT_D) 
+    fprintf(stdout, "a or b too big, or MAXIT_D too small in betacf_d");
+
+  return h;
+}
+
+double betai_d(double a, double b, double x) {
+
+  double bt;
+  if (x < 0.0 || x > 1.0) 
+    fprintf(stdout, "Bad x in routine betai_d");
+
+  if (x == 0.0 || x == 1.0) bt=0.0;
+  else 
+    bt=exp(lgamma(a+b)-lgamma(a)-lgamma(b)+a*log(x)+b*log1p(-x));
+  if (x < (a+1.0)/(a+b+2.0))
+    return bt*betacf_d(a,b,x)/a;
+  else
+    return 1.0-bt*betacf_d(b,a,1.0-x)/b;
+}
+
 #endif
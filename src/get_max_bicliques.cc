@@ -5,7 +5,6 @@
 #include "label_types.h" 
 #include "bigraph.h"
 #include "scored_set.h"
-int non_star = 0;
 #include "mica.h"
 #include "timer.h"
 
@@ -24,7 +23,7 @@ int main(int argc, char** argv)
 
   Labelled_Bigraphs<left_label_t, right_label_t, edge_label_t> graphs;
   double threshold = atof(argv[2]);
-  non_star = atoi(argv[3]);
+  int non_star = atoi(argv[3]);
 
   ofstream results((string(argv[1])+"/bicliques").c_str());
 
@@ -34,8 +33,19 @@ int main(int argc, char** argv)
     return 0;
   }
 
-  read_trees((string(argv[1])+"/left_trees").c_str(), num_of_left_trees, left_trees);
-  read_trees((string(argv[1])+"/right_trees").c_str(), num_of_right_trees, right_trees);
+  map<left_label_t, set<tree_label_t> > left_tree_map;
+  map<right_label_t, set<tree_label_t> > right_tree_map;
+  int num_of_left_trees = 0, num_of_right_trees = 0;
+  read_trees((string(argv[1])+"/left_trees").c_str(), num_of_left_trees, left_tree_map);
+  read_trees((string(argv[1])+"/right_trees").c_str(), num_of_right_trees, right_tree_map);
+  tree_bitmaps<left_label_t, tree_label_t> left_tree_bits(left_tree_map, num_of_left_trees);
+  tree_bitmaps<right_label_t, tree_label_t> right_tree_bits(right_tree_map, num_of_right_trees);
+  mica_context ctx;
+  ctx.non_star = non_star;
+  ctx.num_of_left_trees = num_of_left_trees;
+  ctx.num_of_right_trees = num_of_right_trees;
+  ctx.left_trees = &left_tree_bits;
+  ctx.right_trees = &right_tree_bits;
   graphs.read((string(argv[1])+"/graph.labelled").c_str());
 
   Timer T;
@@ -45,11 +55,16 @@ int main(int argc, char** argv)
       it != graphs.getEdgeTypes().end(); it++) {
 
     ostringstream output;
+    Bigraph<left_label_t, right_label_t> graph = graphs.getGraph(*it);
 
     if(non_star == 2)
-      good_edges<left_label_t, right_label_t, tree_label_t>(graphs.getGraph(*it), threshold, results);
-    else
-      mica<left_label_t, right_label_t, tree_label_t>(graphs.getGraph(*it), threshold, output, cerr);
+      good_edges<left_label_t, right_label_t, tree_label_t>(graph, ctx, threshold, results);
+    else {
+
+      vector<biclique<left_label_t, right_label_t> > found;
+      mica<left_label_t, right_label_t, tree_label_t>(graph, ctx, threshold, found, cerr);
+      print_bicliques(found, output);
+    }
 
     if(!output.str().empty()) {
 
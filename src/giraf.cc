@@ -9,17 +9,18 @@
 #include "catalog.h"
 #include "timer.h"
 #include "options.h"
+#include "segment.h"
+#include "thread_pool.h"
+#include "manifest.h"
+#include "mcmc_split_info.h"
+#include "build_incompat_graph.h"
+#include "extract_reassortments.h"
 
 
 using namespace std;
 
 #define PROG_NAME "giraf"
 
-// the main functions we call
-int main_mcmc_split_info(int, char**);
-int main_build_incompat_graph(int, char**);
-vector<string> main_extract_reassortments(int, char**);
-
 // the global options and data
 vector<string> names;       // holds the tree names
 vector<vector<string>*> tree_files; // holds the tree files
@@ -27,16 +28,20 @@ vector<string> options; // holds all other options
 
 string catalog_filename = "catalog";
 int arch_threshold = 0;
+int jobs = 1;
+int keep_intermediates = 0;
 
 const int MAX_CMD_LINE = 4048;
 
 const char *GIRAF_OPTIONS = "h";
 
-enum {ARCH_THRESH_OPT=1, CATFILE_OPT};
+enum {ARCH_THRESH_OPT=1, CATFILE_OPT, JOBS_OPT, KEEP_OPT};
 
 static struct option MAYBE_UNUSED giraf_long_options[] = {
     {"arch-threshold", 1, 0, ARCH_THRESH_OPT},
     {"out-catalog", 1, 0, CATFILE_OPT},
+    {"jobs", 1, 0, JOBS_OPT},
+    {"keep-intermediates", 0, 0, KEEP_OPT},
     {0,0,0,0}
 };
 
@@ -109,16 +114,16 @@ static
 void
 Usage()
 {
-    void SplitUsage(bool);
-    void GraphUsage(bool);
-    void ExtractUsage(bool);
-
     cerr << "Usage: " << PROG_NAME << " [options] in.giraf" << endl << endl;
 
     cerr << "OPTIONS" << endl
          << "   --out-catalog=filename : save catalog here (default \"catalog\")" << endl
          << "   --arch-threshold=N     : require N segment pairs to support a reassortment"  << endl
          << "                              (default max{3, #seg-2})" << endl 
+         << "   --jobs=N               : read segments and compare pairs of segments" << endl
+         << "                              N at a time (default 1)" << endl
+         << "   --keep-intermediates   : write the files the stages pass each other, and" << endl
+         << "                              reuse the ones that are up to date" << endl
          << endl; 
     SplitUsage(false);
     GraphUsage(false);
@@ -146,6 +151,8 @@ ProcessGirafOptions(int argc, char *argv[])
                 break;
 
             case CATFILE_OPT: catalog_filename = optarg; break;
+            case JOBS_OPT: jobs = max(1, atoi(optarg)); break;
+            case KEEP_OPT: keep_intermediates = 1; break;
             /*default:
                 cerr << "Unknown option." << endl;
                 Usage(); */
@@ -200,85 +207,163 @@ ParseOptions(int argc, char * argv[])
 }
 
 
-int
-main(int argc, char *argv[])
+// parse the options of a stage, called prog, from the giraf options
+template <class Opts>
+void
+ParseStageOptions(
+    const string & prog, 
+    int (*parse)(int, char **, Opts &), 
+    Opts & opts
+    )
 {
     char cmdline[MAX_CMD_LINE];
-    char **newargv;
     vector<string> vec;
+    vec.push_back(prog);
+    vec.push_back("--ignore-bad-options");
+    copy(options.begin(), options.end(), back_inserter(vec));    
+    char ** newargv = MakeCmdArray(vec, cmdline);
+    parse(vec.size(), newargv, opts);
+    delete [] newargv;
+}
 
-    Timer T;
-    cout << PROG_NAME << ": " << T.start();
 
-    ParseOptions(argc, argv);
+// read the trees of segment i; with --keep-intermediates, skip it if the
+// files from a previous run are up to date
+void
+ReadSegment(
+    const SegmentIngester & ingester,
+    const SplitOptions & opts,
+    SegmentCache & segments,
+    unsigned i,
+    ostream & log
+    )
+{
+    if (!keep_intermediates)
+    {
+        ingester.Run(names[i], *tree_files[i], log, &segments.Get(names[i]));
+        return;
+    }
 
-    // create the left mcmc_split_info command line
-    for(unsigned i=0; i<names.size(); i++) 
+    StageManifest manifest("mcmc_split_info");
+    for (unsigned f = 0; f < tree_files[i]->size(); f++)
+    {
+        manifest.AddInput((*tree_files[i])[f]);
+    }
+    manifest.AddOption("burnin", opts.burnin);
+    manifest.AddOption("cull", opts.cull);
+    manifest.AddOption("use-dist", opts.use_dist);
+    manifest.AddOutput(names[i] + "_splits");
+    manifest.AddOutput(names[i] + "_trees");
+    if (opts.use_dist) manifest.AddOutput(names[i] + "_dist");
+
+    string path = names[i] + "_manifest";
+    if (manifest.Matches(path))
     {
-        vec.push_back("mcmc_split_info");
-        vec.push_back("--ignore-bad-options");
-        copy(options.begin(), options.end(), back_inserter(vec));    
-        vec.push_back(names[i]);
-        copy(tree_files[i]->begin(), tree_files[i]->end(), back_inserter(vec));
-
-        // run the left mcmc_split_info command
-        newargv = MakeCmdArray(vec, cmdline);
-        main_mcmc_split_info(vec.size(), newargv);
-        vec.clear();
+        log << PROG_NAME << ": " << names[i] << " is up to date; skipping mcmc_split_info." 
+            << endl;
+        return;
     }
+    StageManifest::Remove(path);
+    ingester.Run(names[i], *tree_files[i], log);
+    manifest.Write(path);
+}
 
-    ReassortDB allreassort;
 
-    string pair_name;
-    // for every pair of segments, run the comparison
-    for(unsigned seg1 = 0; seg1 < names.size(); ++seg1)
+// build the graph of a pair from the files of its segments, unless the graph
+// files from a previous run are up to date
+void
+BuildPairGraph(
+    const IncompatGraphBuilder & builder,
+    const GraphOptions & opts,
+    SegmentData & left,
+    SegmentData & right,
+    const string & pair_name,
+    ostream & log
+    )
+{
+    StageManifest manifest("build_incompat_graph");
+    SegmentData * segments[2] = {&left, &right};
+    for (int k = 0; k < 2; k++)
     {
-        for(unsigned seg2 = seg1+1; seg2 < names.size(); ++seg2)
+        manifest.AddInput(segments[k]->base() + "_splits");
+        manifest.AddInput(segments[k]->base() + "_trees");
+        if (opts.use_dist) manifest.AddInput(segments[k]->base() + "_dist");
+    }
+
+    // only the options that change the outputs; --clade-order,
+    // --incompat-index, --pair-summaries and --threads only change how the
+    // graph is computed, not the graph, so a graph built with any of them is
+    // still up to date
+    manifest.AddOption("use-dist", opts.use_dist);
+    manifest.AddOption("test-all-candidates", opts.all4tests);
+    manifest.AddOption("version-0.9-compat", opts.max_perl_compat);
+    manifest.AddOption("evalue-threshold", opts.evalue_threshold);
+    manifest.AddOption("debug-out-pairs", opts.out_pairs);
+    manifest.AddOption("debug-out-unlabeled", opts.out_unlabeled);
+    manifest.AddOutput(pair_name + "_graph.labels");
+    manifest.AddOutput(pair_name + "_graph.labelled");
+    if (opts.out_pairs) manifest.AddOutput(pair_name + "_pair_test_results");
+    if (opts.out_unlabeled) manifest.AddOutput(pair_name + "_graph");
+
+    string path = pair_name + "_graph.manifest";
+    if (manifest.Matches(path))
+    {
+        log << PROG_NAME << ": " << pair_name << " graph is up to date; "
+            << "skipping build_incompat_graph." << endl;
+        return;
+    }
+    StageManifest::Remove(path);
+    builder.Run(left, right, pair_name, log);
+    manifest.Write(path);
+}
+
+
+// run the comparison of one pair of segments
+vector<string>
+ComparePair(
+    const IncompatGraphBuilder & builder,
+    const GraphOptions & graph_options,
+    const ReassortmentExtractor & extractor,
+    SegmentData & left,
+    SegmentData & right,
+    ostream & log
+    )
+{
+    string pair_name = left.base() + "-" + right.base();
+    log << PROG_NAME << ": Processing " << left.base() << " " << right.base() << endl;
+    if (keep_intermediates)
+    {
+        BuildPairGraph(builder, graph_options, left, right, pair_name, log);
+        return extractor.Run(left, right, pair_name, pair_name, log);
+    }
+
+    // pass the graph in memory
+    LabelledGraph graph;
+    builder.Run(left, right, pair_name, log, &graph);
+    return extractor.Run(left, right, pair_name, pair_name, log, &graph);
+}
+
+
+// merge the reassortments found by the pairs, in pair order, and catalog
+// them if more than 2 segments were given
+void
+CatalogPairs(
+    const vector<pair<unsigned, unsigned> > & pairs,
+    const vector<vector<string> > & found
+    )
+{
+    ReassortDB allreassort;
+    for(unsigned p = 0; p < pairs.size(); ++p)
+    {
+        for(vector<string>::const_iterator F = found[p].begin();
+            F != found[p].end();
+            ++F)
         {
-            vector<string> found;
-
-            cout << PROG_NAME << ": Processing " 
-                 << names[seg1] <<  " " << names[seg2] << endl;
-            pair_name = names[seg1] + "-" + names[seg2];
-
-            // create the build_incomp_graph command line
-            vec.push_back("build_incompat_graph");
-            vec.push_back("--ignore-bad-options");
-            copy(options.begin(), options.end(), back_inserter(vec));    
-            vec.push_back(names[seg1]);
-            vec.push_back(names[seg2]);
-            vec.push_back(pair_name);
-
-            // run the build_incompat_graph command
-            newargv = MakeCmdArray(vec, cmdline);
-            //for(int j = 0; j < 100; j++) cout << cmdline[j] << endl;
-            main_build_incompat_graph(vec.size(), newargv);
-            vec.clear();
-            
-            // create the extract_reassortments command line
-            vec.push_back("extract_reassortments");
-            vec.push_back("--ignore-bad-options");
-            copy(options.begin(), options.end(), back_inserter(vec));    
-            vec.push_back(names[seg1]);
-            vec.push_back(names[seg2]);
-            vec.push_back(pair_name);
-            vec.push_back(pair_name);
-
-            // run the extract_reassortments command
-            newargv = MakeCmdArray(vec, cmdline);
-            found = main_extract_reassortments(vec.size(), newargv);
-            for(vector<string>::iterator F = found.begin();
-                F != found.end();
-                ++F)
-            {
-                allreassort[*F].push_back(make_pair(names[seg1], names[seg2]));
-            }
-            vec.clear();
+            allreassort[*F].push_back(make_pair(names[pairs[p].first], names[pairs[p].second]));
         }
     }
     // allreassort = map from reassort to vector of evidence
 
-    // catalog reassortments if more than 2 segments given
     if(names.size() >= 3) {
         cout << PROG_NAME << ": Writing architectures to file: " 
              << catalog_filename << endl;
@@ -288,6 +373,107 @@ main(int argc, char *argv[])
         cout << PROG_NAME << ": Pair threshold = " << catthreshold << endl;
         CatalogReassortments(allreassort, catout, catthreshold);
     }
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    Timer T;
+    cout << PROG_NAME << ": " << T.start();
+
+    ParseOptions(argc, argv);
+
+    // the options of the stages are the same for every segment and pair
+    SplitOptions split_options;
+    ParseStageOptions("mcmc_split_info", ParseSplitOptions, split_options);
+    SegmentIngester ingester(split_options);
+
+    GraphOptions graph_options;
+    ParseStageOptions("build_incompat_graph", ParseGraphOptions, graph_options);
+
+    ExtractOptions extract_options;
+    ParseStageOptions("extract_reassortments", ParseExtractOptions, extract_options);
+
+    // the tasks below and the threads of the stages share one pool, so
+    // --jobs and --threads never run more than the larger of them at once
+    int threads = graph_options.threads;
+    int pool_size = max(jobs, threads);
+    ThreadPool * pool = (pool_size > 1) ? new ThreadPool(pool_size) : 0;
+    ThreadPool * task_pool = (jobs > 1) ? pool : 0;
+    ThreadPool * stage_pool = (threads > 1) ? pool : 0;
+
+    IncompatGraphBuilder builder(graph_options, stage_pool);
+    ReassortmentExtractor extractor(extract_options, stage_pool);
+
+    // every pair of segments
+    vector<pair<unsigned, unsigned> > pairs;
+    for(unsigned seg1 = 0; seg1 < names.size(); ++seg1)
+    {
+        for(unsigned seg2 = seg1+1; seg2 < names.size(); ++seg2)
+        {
+            pairs.push_back(make_pair(seg1, seg2));
+        }
+    }
+
+    // Every segment is read by one task, and a pair is compared as soon as
+    // both of its segments are read, as many tasks at a time as the pool has
+    // threads (one at a time without --jobs). The output of each task is kept
+    // until the end so that the tasks don't mix their output. The segments
+    // are kept in memory, or with --keep-intermediates written to files and
+    // loaded on first use, and shared by all the pairs they are in.
+    SegmentCache segments;
+    vector<string> segment_logs(names.size());
+    vector<string> pair_logs(pairs.size());
+    vector<vector<string> > found(pairs.size());
+    {
+        TaskGraph tasks(task_pool);
+        vector<int> read_task(names.size());
+        for(unsigned i = 0; i < names.size(); ++i)
+        {
+            read_task[i] = tasks.Add([&, i]() {
+                if (!task_pool)
+                {
+                    ReadSegment(ingester, split_options, segments, i, cout);
+                    return;
+                }
+                ostringstream log;
+                ReadSegment(ingester, split_options, segments, i, log);
+                segment_logs[i] = log.str();
+            });
+        }
+
+        vector<int> pair_tasks;
+        for(unsigned p = 0; p < pairs.size(); ++p)
+        {
+            vector<int> deps;
+            deps.push_back(read_task[pairs[p].first]);
+            deps.push_back(read_task[pairs[p].second]);
+            pair_tasks.push_back(tasks.Add([&, p]() {
+                SegmentData & left = segments.Get(names[pairs[p].first]);
+                SegmentData & right = segments.Get(names[pairs[p].second]);
+                if (!task_pool)
+                {
+                    found[p] = ComparePair(builder, graph_options, extractor, left, right, cout);
+                    return;
+                }
+                ostringstream log;
+                found[p] = ComparePair(builder, graph_options, extractor, left, right, log);
+                pair_logs[p] = log.str();
+            }, deps));
+        }
+
+        // the catalog needs every pair
+        tasks.Add([&]() {
+            for(unsigned i = 0; i < segment_logs.size(); ++i) cout << segment_logs[i];
+            for(unsigned p = 0; p < pair_logs.size(); ++p) cout << pair_logs[p];
+            CatalogPairs(pairs, found);
+        }, pair_tasks);
+
+        tasks.Run();
+    }
+    delete pool;
+
     cout << PROG_NAME << ": " << T.stop();
     cout << PROG_NAME << ": " << T.report() << endl;
     cout << PROG_NAME << ": done." << endl;
@@ -0,0 +1,30 @@
+#ifndef LABELLED_GRAPH_H
+#define LABELLED_GRAPH_H
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//
+// The labelled incompatibility graph of a pair of segments, as it is written
+// to <base>_graph.labels and <base>_graph.labelled. Every edge joins a left
+// split and a right split and has four candidate sets; the bits of moved say
+// which of them label the edge.
+//
+struct LabelledGraph
+{
+    vector<string> labels;              // the taxa of every label
+    vector<pair<int, int> > edges;      // (left split id, right split id)
+    vector<int> candidates;             // 4 labels for every edge
+    vector<unsigned char> moved;        // bit k: candidate k labels the edge
+    bool all_candidates;                // true if not filtered by distance
+
+    int candidate(long e, int k) const { return candidates[4 * e + k]; }
+    bool has_label(long e, int k) const { return (moved[e] >> k) & 1; }
+};
+
+void PrintLabelMapping(ostream &, const LabelledGraph &);
+void PrintLabelledGraph(ostream &, const LabelledGraph &);
+
+#endif
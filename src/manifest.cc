@@ -0,0 +1,84 @@
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+#include "manifest.h"
+#include "util.h"
+
+//===========================================================================
+// Stage manifests
+//===========================================================================
+
+// the 64-bit FNV-1a hash of the contents of a file
+uint64_t
+HashFile(const string & name)
+{
+    ifstream in(name.c_str(), ios::binary);
+    DIE_IF(!in, "Can't read " + name);
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    char buf[1 << 16];
+    while (in.read(buf, sizeof(buf)) || in.gcount() > 0)
+    {
+        for (streamsize i = 0; i < in.gcount(); i++)
+        {
+            h = (h ^ (unsigned char)buf[i]) * 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+
+StageManifest::StageManifest(const string & stage)
+{
+    // print the options exactly
+    _text.precision(17);
+    _text << "version " GIRAF_VERSION "\n"
+          << "stage " << stage << "\n";
+}
+
+
+void
+StageManifest::AddInput(const string & filename)
+{
+    ostringstream hash;
+    hash << hex << HashFile(filename);
+    _text << "input " << filename << " " << hash.str() << "\n";
+}
+
+
+bool
+StageManifest::Matches(const string & path) const
+{
+    for (unsigned i = 0; i < _outputs.size(); i++)
+    {
+        if (access(_outputs[i].c_str(), F_OK) != 0) return false;
+    }
+
+    ifstream in(path.c_str());
+    if (!in) return false;
+    ostringstream old;
+    old << in.rdbuf();
+    return old.str() == _text.str();
+}
+
+
+// write to a temporary file that replaces path when complete
+void
+StageManifest::Write(const string & path) const
+{
+    string tmp = path + ".tmp";
+    ofstream out(tmp.c_str());
+    DIE_IF(!out, "Can't write " + tmp);
+    out << _text.str();
+    out.close();
+    DIE_IF(!out, "Error writing " + tmp);
+    DIE_IF(rename(tmp.c_str(), path.c_str()) != 0, "Can't rename " + tmp + " to " + path);
+}
+
+
+// remove the manifest of outputs that are about to be rewritten
+void
+StageManifest::Remove(const string & path)
+{
+    unlink(path.c_str());
+}
@@ -0,0 +1,47 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// the version of the stage outputs; change it when a stage writes something
+// different from the same inputs, so that old outputs are not reused
+#define GIRAF_VERSION "1.0"
+
+uint64_t HashFile(const string &);
+
+//
+// What the outputs of a stage were computed from: the contents of its input
+// files, the version of GIRAF and the options the stage reads. The manifest
+// is written next to the outputs once they are complete, so that a rerun can
+// skip the stage if its manifest still matches.
+//
+class StageManifest
+{
+public:
+    explicit StageManifest(const string & stage);
+
+    void AddInput(const string & filename);
+    void AddOutput(const string & filename) { _outputs.push_back(filename); }
+
+    template <class T>
+    void AddOption(const string & name, const T & value)
+    {
+        _text << "option " << name << " " << value << "\n";
+    }
+
+    // true if the manifest at path is the same and every output exists
+    bool Matches(const string & path) const;
+
+    void Write(const string & path) const;
+    static void Remove(const string & path);
+
+private:
+    ostringstream _text;
+    vector<string> _outputs;
+};
+
+#endif
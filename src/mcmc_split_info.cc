@@ -2,12 +2,16 @@
 #include "tree.h"
 #include "splits.h"
 #include "options.h"
+#include "mcmc_split_info.h"
 
 #define PROG_NAME "mcmc_split_info"
 
-int dist_opt = 1;
-int burnin_opt = 500;
-float cull_opt = 0.05;
+SplitOptions::SplitOptions()
+    : use_dist(true),
+      burnin(500),
+      cull(0.05)
+{
+}
 
 // Options for mcmc_split_info
 const char * SPLIT_OPTIONS = "h";
@@ -23,7 +27,7 @@ static struct option MAYBE_UNUSED split_long_options[] = {
 };
 
 void
-SplitUsage(bool show_cmd = true)
+SplitUsage(bool show_cmd)
 {
     if(show_cmd) {
         cerr << PROG_NAME << " [options] nexfile.nex [file2.nex...]" << endl << endl;
@@ -37,9 +41,9 @@ SplitUsage(bool show_cmd = true)
     if(show_cmd) exit(3);
 }
 
-static
+// parse the options into opts; returns the index of the first argument
 int
-ProcessOptions(int argc, char *argv[])
+ParseSplitOptions(int argc, char *argv[], SplitOptions & opts)
 {
     bool ignore_bad_opt = false;
     opterr = 0;
@@ -52,9 +56,9 @@ ProcessOptions(int argc, char *argv[])
         switch(a)
         {
             case 'h': SplitUsage(); break;
-            case DIST_OPT: dist_opt = atoi(optarg); break;
-            case BURNIN_OPT: burnin_opt = atoi(optarg); break;
-            case CULL_OPT: cull_opt = atof(optarg); break;
+            case DIST_OPT: opts.use_dist = (atoi(optarg) > 0); break;
+            case BURNIN_OPT: opts.burnin = atoi(optarg); break;
+            case CULL_OPT: opts.cull = atof(optarg); break;
             case SPLIT_BAD_OPT: ignore_bad_opt = true; break;
             default:
                 if(!ignore_bad_opt) {
@@ -63,29 +67,28 @@ ProcessOptions(int argc, char *argv[])
                 }
         }
     }
-    if(optind+1 >= argc) SplitUsage();
     return optind;
 }
 
 
-int
-main_mcmc_split_info(int argc, char *argv[])
+void
+SegmentIngester::Run(
+    const string & basename,
+    const vector<string> & files,
+    ostream & log,
+    SegmentData * segment   // if not 0, store the results here
+    ) const
 {
-    cout << PROG_NAME ": built on " << __DATE__ << endl;
-
-    int first_file_index = ProcessOptions(argc, argv);
-    string basename = argv[first_file_index];
-
-    cout << PROG_NAME ": Burn-in = " << burnin_opt << endl;
-    cout << PROG_NAME ": Distance = " << dist_opt << endl;
-    cout << PROG_NAME ": Cull = " << cull_opt << endl;
+    log << PROG_NAME ": Burn-in = " << _options.burnin << endl;
+    log << PROG_NAME ": Distance = " << _options.use_dist << endl;
+    log << PROG_NAME ": Cull = " << _options.cull << endl;
 
     vector<TreeNode *> trees;
 
-    for (int i = first_file_index+1; i < argc; i++)
+    for (unsigned i = 0; i < files.size(); i++)
     {
-        cout << PROG_NAME ": Reading " << argv[i] << " ..." << endl;
-        ifstream nexus(argv[i]);
+        log << PROG_NAME ": Reading " << files[i] << " ..." << endl;
+        ifstream nexus(files[i].c_str());
         if(!nexus) {
             DIE("Couldn't read tree file.");
         }
@@ -99,54 +102,79 @@ main_mcmc_split_info(int argc, char *argv[])
         }
 
         // write what we found
-        cout << PROG_NAME << ": Found " << leafs.size() 
-             << " mapping entries in " << argv[i] << endl;
+        log << PROG_NAME << ": Found " << leafs.size() 
+            << " mapping entries in " << files[i] << endl;
        
         // reset the file
         nexus.seekg(0, ios::beg);
 
         // read the tree collection
-        ReadNexTrees(nexus, ptr, trees, burnin_opt);
+        ReadNexTrees(nexus, ptr, trees, _options.burnin);
     } 
 
-    cout << PROG_NAME ": Read " << trees.size() << " trees total." << endl;
+    log << PROG_NAME ": Read " << trees.size() << " trees total." << endl;
 
     // find all the splits
     SplitDatabase splits;
     AllSplits(trees, splits);
-    cout << PROG_NAME ": Extracted " << splits.size() << " splits." << endl;
+    log << PROG_NAME ": Extracted " << splits.size() << " splits." << endl;
 
     // Remove the splits that don't occur very often
-    CullSplits(splits, (int)(trees.size()*cull_opt)); 
-
-    cout << PROG_NAME ": Found " << splits.size() << " splits total." << endl;
+    CullSplits(splits, (int)(trees.size()*_options.cull)); 
 
-    string tmp;
-    tmp = basename + "_splits";
-    ofstream outsplits(tmp.c_str());
-    PrintSplitsMapping(outsplits, splits);
-    outsplits.close();
+    log << PROG_NAME ": Found " << splits.size() << " splits total." << endl;
 
-    tmp = basename + "_trees";
-    ofstream outtrees(tmp.c_str());
-    PrintTreesForSplits(outtrees, trees.size(), splits);
+    vector<DistanceMatrix> * matrices = 0;
+    if (_options.use_dist)
+    {
+        log << PROG_NAME ": Computing matrix:";
+        matrices = AllDistanceMatrices(trees, log);
+        log << endl;
+        log << PROG_NAME ": Finished computing distance matrices..." << endl;
+    }
 
-    if (dist_opt > 0)
+    if (segment)
+    {
+        segment->Store(splits, trees.size(), matrices);
+    }
+    else
     {
-        tmp = basename + "_dist";
-        ofstream outdist(tmp.c_str());
-        cout << PROG_NAME ": Computing matrix:";
-        vector<DistanceMatrix> * matrices = AllDistanceMatrices(trees);
-        cout << endl;
-        cout << PROG_NAME ": Finished computing distance matrices..." << endl;
-        PrintDistances(outdist, *matrices);
-        delete matrices;
-        outdist.close();
+        string tmp;
+        tmp = basename + "_splits";
+        ofstream outsplits(tmp.c_str());
+        PrintSplitsMapping(outsplits, splits);
+        outsplits.close();
+
+        tmp = basename + "_trees";
+        ofstream outtrees(tmp.c_str());
+        PrintTreesForSplits(outtrees, trees.size(), splits);
+
+        if (matrices)
+        {
+            tmp = basename + "_dist";
+            ofstream outdist(tmp.c_str());
+            PrintDistances(outdist, *matrices);
+            outdist.close();
+        }
     }
+    delete matrices;
 
     // delete all the trees
     for_each(trees.begin(), trees.end(), DeleteTree);
+}
+
 
+int
+main_mcmc_split_info(int argc, char *argv[])
+{
+    cout << PROG_NAME ": built on " << __DATE__ << endl;
+
+    SplitOptions options;
+    int first_file_index = ParseSplitOptions(argc, argv, options);
+    if(first_file_index+1 >= argc) SplitUsage();
+
+    SegmentIngester ingester(options);
+    ingester.Run(argv[first_file_index], 
+        vector<string>(argv + first_file_index + 1, argv + argc), cout);
     return 0; 
 }
-
@@ -0,0 +1,43 @@
+#ifndef MCMC_SPLIT_INFO_H
+#define MCMC_SPLIT_INFO_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include "segment.h"
+
+using namespace std;
+
+// The options of mcmc_split_info
+struct SplitOptions
+{
+    SplitOptions();
+
+    bool use_dist;
+    int burnin;
+    float cull;
+};
+
+int ParseSplitOptions(int, char **, SplitOptions &);
+void SplitUsage(bool = true);
+
+
+//
+// Reads the trees of one segment from its nexus files and writes the
+// segment's <basename>_splits, <basename>_trees and (with use_dist)
+// <basename>_dist, or stores what they hold in a SegmentData if one is given.
+// The ingester keeps no state between runs, so several segments can be read
+// at once.
+//
+class SegmentIngester
+{
+public:
+    explicit SegmentIngester(const SplitOptions & options) : _options(options) {}
+
+    void Run(const string &, const vector<string> &, ostream &, 
+        SegmentData * = 0) const;
+
+private:
+    SplitOptions _options;
+};
+
+#endif
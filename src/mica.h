@@ -9,147 +9,340 @@
 #include <iostream>
 #include <algorithm>	
 #include <fstream>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
 #include "bigraph.h"
 #include "scored_set.h"
+#include "thread_pool.h"
 
 const double SIZE = 50;
 
-template<class data_t>
-void print_set(const set<data_t>& given_set, ostream& output_stream) {
+// what the biclique search needs to know about the pair of segments
+struct mica_context {
 
-  typename set<data_t>::iterator it = given_set.begin(); output_stream << *it; 
+  mica_context() : pool(0), max_sets(0), max_seconds(0) {}
+
+  int non_star;   // 0 for all bicliques, 1 for non-star bicliques
+  int num_of_left_trees; int num_of_right_trees;
+  const tree_bitmaps<left_label_t, tree_label_t>* left_trees;    // trees each node occurs in
+  const tree_bitmaps<right_label_t, tree_label_t>* right_trees;
+  ThreadPool* pool;   // runs the expand rounds in parallel, if not 0
+  size_t max_sets;     // limits on the search of one label; 0 for none
+  double max_seconds;
+};
+
+// tells when the search of a label has run out of time
+class mica_clock {
+
+ public:
+
+  explicit mica_clock(double max_seconds) 
+    : limited(max_seconds > 0), 
+      deadline(chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(max_seconds))) { }
+
+  bool expired() const { return limited && chrono::steady_clock::now() >= deadline; }
+
+ private:
+
+  bool limited;
+  chrono::steady_clock::time_point deadline;
+};
+
+// a maximal biclique and the support of its two sides
+template<class left_label_t, class right_label_t>
+struct biclique {
+
+  vector<left_label_t> left_nodes;
+  vector<right_label_t> right_nodes;
+  double left_score; double right_score;
+};
+
+template<class container_t>
+void print_set(const container_t& given_set, ostream& output_stream) {
+
+  typename container_t::const_iterator it = given_set.begin(); output_stream << *it; 
   for(it++; it != given_set.end(); it++)
     output_stream << " " << *it;
 }
 
-template<class in_label_t, class out_label_t>
-set<out_label_t> retrieve_other_set(const set<in_label_t>& input_set, map<in_label_t, set<out_label_t> >& adjacency) {
-
-  set<out_label_t> output_set;
+// write the bicliques as the lines "left nodes", "right nodes", "scores"
+template<class left_label_t, class right_label_t>
+void print_bicliques(const vector<biclique<left_label_t, right_label_t> >& bicliques, ostream& results) {
 
-  typename set<in_label_t>::iterator it = input_set.begin();
-  output_set = adjacency[*it];
+  for(typename vector<biclique<left_label_t, right_label_t> >::const_iterator it = bicliques.begin(); it != bicliques.end(); it++) {
 
-  for(it++; it != input_set.end(); it++) {
-
-    set<out_label_t> result;
-    set_intersection(output_set.begin(), output_set.end(), 
-		     adjacency[*it].begin(), adjacency[*it].end(),
-		     inserter(result, result.begin()));
-    swap(result, output_set);
+    print_set(it->left_nodes, results); results << endl;
+    print_set(it->right_nodes, results); results << endl;
+    results << it->left_score << " " << it->right_score << endl << endl;
   }
-
-  return output_set;
 }
 
 template<class left_label_t, class right_label_t, class tree_label_t>
-void output_results(ostream& results, Bigraph<left_label_t, right_label_t>& graph, double threshold, const set<scored_set<right_label_t, tree_label_t> >& all) {
+void output_results(vector<biclique<left_label_t, right_label_t> >& results, Bigraph<left_label_t, right_label_t>& graph, const mica_context& ctx, double threshold, const vector<scored_set<right_label_t, tree_label_t> >& all) {
 
-  for(typename set<scored_set<right_label_t, tree_label_t> >::iterator it = all.begin(); it != all.end(); it++) {
+  results.clear();
+  vector<left_label_t> left_ids;
+  for(typename vector<scored_set<right_label_t, tree_label_t> >::const_iterator it = all.begin(); it != all.end(); it++) {
 
-    scored_set<left_label_t, tree_label_t> 
-      left_nodes(retrieve_other_set<right_label_t, left_label_t>(it->get_nodes(), graph.get_right_adjacency()), left_trees, num_of_left_trees);
+    set<right_label_t> right_nodes(it->get_nodes());
+    graph.common_left_neighbours(right_nodes, left_ids);
+    scored_set<left_label_t, tree_label_t> left_nodes(left_ids.begin(), left_ids.end(), *ctx.left_trees);
 
-    if(left_nodes.score(num_of_left_trees) > threshold && 
-       (non_star == 0 || (left_nodes.get_nodes().size() > 1 && it->get_nodes().size() > 1))) {
+    if(left_nodes.score(ctx.num_of_left_trees) > threshold && 
+       (ctx.non_star == 0 || (left_nodes.num_nodes() > 1 && it->num_nodes() > 1))) {
 
-      print_set<left_label_t>(left_nodes.get_nodes(), results); results << endl;
-      print_set<right_label_t>(it->get_nodes(), results); results << endl;
-      results << left_nodes.score(num_of_left_trees) << " " << it->score(num_of_right_trees) << endl << endl;
+      biclique<left_label_t, right_label_t> found;
+      found.left_nodes = left_ids;
+      found.right_nodes.assign(right_nodes.begin(), right_nodes.end());
+      found.left_score = left_nodes.score(ctx.num_of_left_trees);
+      found.right_score = it->score(ctx.num_of_right_trees);
+      results.push_back(found);
     }
   }
 }
 
-template<class left_label_t, class right_label_t, class tree_label_t>
-void expand_stars(Bigraph<left_label_t, right_label_t>& graph, double threshold, const set<scored_set<right_label_t, tree_label_t> >& stars, 
-		  set<scored_set<right_label_t, tree_label_t> >& result) {
+//
+// The sets of a round are found in the order of the (sorted) sets they are
+// the intersections of, and when the same nodes are found twice the first
+// one is kept, since its trees depend on how it was found. The new sets are
+// returned sorted.
+//
+// The rows are searched in blocks on ctx.pool (if not 0), every block into
+// its own table, and the tables are merged in shards by fingerprint. Equal
+// sets fall into the same shard and every shard takes the blocks in order,
+// so each shard keeps the same sets as a search on one thread.
+//
 
-  result.clear();
+template<class right_label_t, class tree_label_t>
+bool expand_pairs(const mica_context& ctx, double threshold, const vector<scored_set<right_label_t, tree_label_t> >& rows, 
+		  const vector<scored_set<right_label_t, tree_label_t> >& cols, bool upper, const scored_set_table<right_label_t, tree_label_t>& all, 
+		  size_t limit, const mica_clock& clock, vector<scored_set<right_label_t, tree_label_t> >& result) {
+
+  typedef scored_set<right_label_t, tree_label_t> set_t;
+  typedef scored_set_table<right_label_t, tree_label_t> table_t;
+
+  // small enough blocks that idle threads have something to steal
+  long threads = ctx.pool ? ctx.pool->size() : 1;
+  long block = max(1L, (long)rows.size() / (threads > 1 ? 8 * threads : 1));
+  long num_blocks = (rows.size() + block - 1) / block;
+
+  // a block stops once it has more than limit sets, since the first limit
+  // sets of the round are among the first limit sets of their blocks; the
+  // round is truncated only if it found a set past the limit
+  vector<table_t> found(num_blocks);
+  vector<vector<vector<pair<uint64_t, size_t> > > > shards(num_blocks, vector<vector<pair<uint64_t, size_t> > >(threads));
+  atomic<bool> expired(false);
+
+  ParallelChunks(ctx.pool, rows.size(), block, [&](long begin, long end) {
+
+      long b = begin / block;
+      for(long i = begin; i < end && found[b].size() <= limit; i++) {
+
+	if(clock.expired()) { expired = true; break; }
+
+	for(size_t j = upper ? i + 1 : 0; j < cols.size() && found[b].size() <= limit; j++) {
+
+	  set_t intersection = rows[i].intersect(cols[j]);
+	  if(intersection.score(ctx.num_of_right_trees) > threshold && !all.contains(intersection))
+	    found[b].insert(intersection);
+	}
+      }
+
+      if(threads > 1)
+	for(size_t k = 0; k < found[b].size(); k++) {
 
-  for(typename set<scored_set<right_label_t, tree_label_t> >::iterator it1 = stars.begin(); it1 != stars.end(); it1++)
-    for(typename set<scored_set<right_label_t, tree_label_t> >::iterator it2 = it1; ++it2 != stars.end(); ) {
+	  uint64_t h = found[b].get_sets()[k].fingerprint();
+	  shards[b][h % threads].push_back(make_pair(h, k));
+	}
+    });
+
+  // the blocks merged; order[s] holds the block and index of the sets of
+  // shard s, which is the order a search on one thread finds them in
+  vector<table_t> merged(num_blocks <= 1 ? 0 : threads);
+  vector<vector<pair<long, size_t> > > order(merged.size());
+  ParallelChunks(ctx.pool, merged.size(), 1, [&](long s, long) {
 
-      scored_set<right_label_t, tree_label_t> intersection = it1->intersect(*it2);
+      for(long b = 0; b < num_blocks; b++)
+	for(size_t k = 0; k < shards[b][s].size(); k++)
+	  if(merged[s].insert(found[b].get_sets()[shards[b][s][k].second], shards[b][s][k].first))
+	    order[s].push_back(make_pair(b, shards[b][s][k].second));
+    });
 
-      if(intersection.score(num_of_right_trees) > threshold && stars.find(intersection) == stars.end() &&       
-	 result.find(intersection) == result.end())
-	  result.insert(intersection);
+  result.clear();
+  if(num_blocks == 1)
+    result = found[0].get_sets();
+  for(size_t s = 0; s < merged.size(); s++)
+    result.insert(result.end(), merged[s].get_sets().begin(), merged[s].get_sets().end());
+
+  bool truncated = expired;
+  if(result.size() > limit) {
+
+    truncated = true;
+    if(num_blocks > 1) {
+
+      vector<pair<pair<long, size_t>, size_t> > by_order;
+      for(size_t s = 0, n = 0; s < merged.size(); s++)
+	for(size_t k = 0; k < order[s].size(); k++, n++)
+	  by_order.push_back(make_pair(order[s][k], n));
+      sort(by_order.begin(), by_order.end());
+
+      vector<set_t> first;
+      for(size_t k = 0; k < limit; k++)
+	first.push_back(result[by_order[k].second]);
+      swap(result, first);
     }
+    else result.erase(result.begin() + limit, result.end());
+  }
+
+  sort(result.begin(), result.end());
+  return truncated;
 }
 
 template<class left_label_t, class right_label_t, class tree_label_t>
-void expand(Bigraph<left_label_t, right_label_t>& graph, double threshold, const set<scored_set<right_label_t, tree_label_t> >& stars, 
-	    const set<scored_set<right_label_t, tree_label_t> >& current, const set<scored_set<right_label_t, tree_label_t> >& all, 
-	    set<scored_set<right_label_t, tree_label_t> >& result) {
+bool expand_stars(Bigraph<left_label_t, right_label_t>& graph, const mica_context& ctx, double threshold, const vector<scored_set<right_label_t, tree_label_t> >& stars, 
+		  const scored_set_table<right_label_t, tree_label_t>& all, size_t limit, const mica_clock& clock, vector<scored_set<right_label_t, tree_label_t> >& result) {
 
-  result.clear();
+  return expand_pairs(ctx, threshold, stars, stars, true, all, limit, clock, result);
+}
 
-  for(typename set<scored_set<right_label_t, tree_label_t> >::iterator it1 = stars.begin(); it1 != stars.end(); it1++)
-    for(typename set<scored_set<right_label_t, tree_label_t> >::iterator it2 = current.begin(); it2 != current.end(); it2++) {
+template<class left_label_t, class right_label_t, class tree_label_t>
+bool expand(Bigraph<left_label_t, right_label_t>& graph, const mica_context& ctx, double threshold, const vector<scored_set<right_label_t, tree_label_t> >& stars, 
+	    const vector<scored_set<right_label_t, tree_label_t> >& current, const scored_set_table<right_label_t, tree_label_t>& all, 
+	    size_t limit, const mica_clock& clock, vector<scored_set<right_label_t, tree_label_t> >& result) {
 
-      scored_set<right_label_t, tree_label_t> intersection = it1->intersect(*it2);
-      if(intersection.score(num_of_right_trees) > threshold && all.find(intersection) == all.end() && 
-	 result.find(intersection) == result.end())
-	  result.insert(intersection);
-    }
+  return expand_pairs(ctx, threshold, stars, current, false, all, limit, clock, result);
 }
 
+//
+// When ctx.max_sets or ctx.max_seconds is reached the search stops, keeping
+// the sets found so far (with max_sets, the first ones a search on one
+// thread finds), and truncated is set if a set was left out. The stars are
+// always kept.
+//
+
 template<class left_label_t, class right_label_t, class tree_label_t>
-size_t mica(Bigraph<left_label_t, right_label_t>& graph, double threshold, ostream& results, ostream & debug = cout) {
+size_t mica(Bigraph<left_label_t, right_label_t>& graph, const mica_context& ctx, double threshold, vector<biclique<left_label_t, right_label_t> >& results, 
+	    ostream & debug = cout, bool* truncated = 0) {
 
   size_t rank(1);
-  set<scored_set<right_label_t, tree_label_t> > stars, current, all, result;
+  scored_set_table<right_label_t, tree_label_t> all;
+  vector<scored_set<right_label_t, tree_label_t> > stars, current, result;
+  mica_clock clock(ctx.max_seconds);
+  bool stopped = false;
 
-  for(typename map<left_label_t, set<right_label_t> >::iterator it = graph.get_left_adjacency().begin(); it != graph.get_left_adjacency().end(); it++) {
+  for(size_t i = 0; i < graph.num_left(); i++) {
     
-    scored_set<right_label_t, tree_label_t> star(it->second, right_trees, num_of_right_trees);
-    if(star.score(num_of_right_trees) > threshold) {
-      stars.insert(star);
+    if(graph.left_removed(i)) continue;
+    scored_set<right_label_t, tree_label_t> star(graph.left_begin(i), graph.left_end(i), *ctx.right_trees);
+    if(star.score(ctx.num_of_right_trees) > threshold && all.insert(star)) {
+      stars.push_back(star);
     }
   }
+  sort(stars.begin(), stars.end());
 
-  all = stars;
+  current = stars;
+  for(bool first = true; !current.empty(); first = false) {
 
-  rank++;
-  expand_stars(graph, threshold, stars, current);
-  copy(current.begin(), current.end(), inserter(all, all.begin()));
-
-  while (!current.empty()) {
+    // a round at the limit still looks for one more set, so that a search
+    // that has found all its sets is not truncated
+    size_t limit = !ctx.max_sets ? SIZE_MAX : (all.size() >= ctx.max_sets ? 0 : ctx.max_sets - all.size());
 
     rank++;
-    expand(graph, threshold, stars, current, all, result); swap(current, result);
-    copy(current.begin(), current.end(), inserter(all, all.begin()));
+    stopped = first ? 
+      expand_stars(graph, ctx, threshold, stars, all, limit, clock, result) :
+      expand(graph, ctx, threshold, stars, current, all, limit, clock, result);
+    swap(current, result);
+    for(size_t i = 0; i < current.size(); i++) all.insert(current[i]);
+    if(stopped) break;
   }
+  if(truncated) *truncated = stopped;
 
-  output_results(results, graph, threshold, all);
+  // the bicliques are written in the order of their nodes
+  vector<scored_set<right_label_t, tree_label_t> > sorted(all.get_sets());
+  sort(sorted.begin(), sorted.end());
+  output_results(results, graph, ctx, threshold, sorted);
   
   return all.size();
 }
 
+//
+// An upper bound on the confidence 1 - prod(1 - pa * pb) of the bicliques
+// mica reports for the graph, or -1 if it reports none, or, with multiple,
+// fewer than two. Every right score is at most the best star score, every
+// left score at most that of all the left nodes, and the closed sets of s
+// stars are at most 2^s - 1. The stars that find a set all hold its nodes,
+// so they share the trees of any one of them; only a node that is in no
+// tree can give a set no trees and a score that is not a fraction (see
+// scored_set::score), and then the bound is infinite.
+//
+
+template<class left_label_t, class right_label_t, class tree_label_t>
+double confidence_bound(Bigraph<left_label_t, right_label_t>& graph, const mica_context& ctx, double threshold, bool multiple) {
+
+  typedef scored_set<right_label_t, tree_label_t> set_t;
+
+  for(size_t i = 0; i < graph.num_right(); i++)
+    if(!graph.right_removed(i) && !ctx.right_trees->in_some_tree(graph.right_node(i))) return INFINITY;
+
+  vector<left_label_t> left_nodes;
+  for(size_t i = 0; i < graph.num_left(); i++) {
+
+    if(graph.left_removed(i)) continue;
+    if(!ctx.left_trees->in_some_tree(graph.left_node(i))) return INFINITY;
+    left_nodes.push_back(graph.left_node(i));
+  }
+
+  // the distinct stars above the threshold, the best of them and the largest
+  scored_set_table<right_label_t, tree_label_t> stars;
+  double best_star = 0; size_t largest_star = 0;
+  for(size_t i = 0; i < graph.num_left(); i++) {
+    
+    if(graph.left_removed(i)) continue;
+    set_t star(graph.left_begin(i), graph.left_end(i), *ctx.right_trees);
+    if(star.score(ctx.num_of_right_trees) <= threshold || !stars.insert(star)) continue;
+
+    best_star = max(best_star, star.score(ctx.num_of_right_trees));
+    largest_star = max(largest_star, size_t(graph.left_end(i) - graph.left_begin(i)));
+  }
+  if(stars.size() == 0) return -1;
+
+  double best_left = scored_set<left_label_t, tree_label_t>(left_nodes.begin(), left_nodes.end(), *ctx.left_trees).score(ctx.num_of_left_trees);
+  if(best_left <= threshold) return -1;
+  if(ctx.non_star != 0 && (left_nodes.size() < 2 || largest_star < 2)) return -1;
+
+  double num_sets = (stars.size() >= 63) ? INFINITY : double((1ULL << stars.size()) - 1);
+  if(multiple && num_sets < 2) return -1;
+
+  // the confidence multiplies its factors in another order, so the bound is
+  // rounded up a little; no confidence is more than 1
+  return min(1.0, 1.0 - pow(1.0 - best_star * best_left, num_sets) + 1e-12);
+}
+
 template<class left_label_t, class right_label_t, class tree_label_t>
-  size_t good_edges(Bigraph<left_label_t, right_label_t>& graph, double threshold, ostream& results, ostream & debug = cout) {
+  size_t good_edges(Bigraph<left_label_t, right_label_t>& graph, const mica_context& ctx, double threshold, ostream& results, ostream & debug = cout) {
 
   size_t count = 0;
   
-  for(typename map<left_label_t, set<right_label_t> >::iterator it = graph.get_left_adjacency().begin(); it != graph.get_left_adjacency().end(); it++) {
+  for(size_t i = 0; i < graph.num_left(); i++) {
     
-    set<left_label_t> left_node; left_node.insert(it->first);
+    const left_label_t& left_node = graph.left_node(i);
     scored_set<left_label_t, tree_label_t> 
-      scored_left_node(left_node, left_trees, num_of_left_trees);
+      scored_left_node(&left_node, &left_node + 1, *ctx.left_trees);
     
-    if(scored_left_node.score(num_of_left_trees) > threshold) {
+    if(scored_left_node.score(ctx.num_of_left_trees) > threshold) {
       
-      for(typename set<right_label_t>::iterator it2 = it->second.begin(); it2 != it->second.end(); it2++) {
+      for(const right_label_t* it2 = graph.left_begin(i); it2 != graph.left_end(i); it2++) {
 	
-	set<right_label_t> right_node; right_node.insert(*it2);
 	scored_set<right_label_t, tree_label_t> 
-	  scored_right_node(right_node, right_trees, num_of_right_trees);
+	  scored_right_node(it2, it2 + 1, *ctx.right_trees);
 	
-	if(scored_right_node.score(num_of_right_trees) > threshold) {
+	if(scored_right_node.score(ctx.num_of_right_trees) > threshold) {
 	  
-	  results << it->first << endl;
+	  results << left_node << endl;
 	  results << *it2 << endl << endl;
-	  results << scored_left_node.score(num_of_left_trees) << " " << scored_right_node.score(num_of_right_trees) << endl << endl;
+	  results << scored_left_node.score(ctx.num_of_left_trees) << " " << scored_right_node.score(ctx.num_of_right_trees) << endl << endl;
 	  count++;
 	}
       }
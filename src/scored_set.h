@@ -5,11 +5,10 @@
 #include <set>
 #include <fstream>
 #include <algorithm>
+#include <iterator>
+#include <unordered_map>
 #include "label_types.h"
-
-int num_of_left_trees; int num_of_right_trees;
-map<left_label_t, set<tree_label_t> > left_trees;
-map<right_label_t, set<tree_label_t> > right_trees;
+#include "bitvec.h"
 
 
 template<class node_label_t, class tree_label_t>
@@ -39,61 +38,203 @@ void read_trees(const char* filename, int& num_of_trees, map<node_label_t, set<t
   input_file.close();
 }
 
+//
+// The trees, out of 0..N, that each node (a non-negative integer label)
+// occurs in, as a bitset per node. They are built once per segment, so that
+// the trees of any set of its nodes are just the OR of their bitsets.
+//
+template<class node_label_t, class tree_label_t>
+class tree_bitmaps {
+
+ public:
+
+  tree_bitmaps(const map<node_label_t, set<tree_label_t> >& tree_map, int num_of_trees) 
+    : num_of_trees(num_of_trees), words(WordsFor(num_of_trees + 1)) {
+
+    if(tree_map.empty()) return;
+    size_t num_of_nodes = tree_map.rbegin()->first + 1;
+    bits.assign(num_of_nodes * words, 0);
+    found.assign(num_of_nodes, 0);
+
+    for(typename map<node_label_t, set<tree_label_t> >::const_iterator it = tree_map.begin(); it != tree_map.end(); it++) {
+
+      if(it->first < 0) continue;
+      found[it->first] = 1;
+      for(typename set<tree_label_t>::const_iterator t = it->second.begin(); t != it->second.end(); t++)
+	if(*t >= 0 && *t <= num_of_trees)
+	  SetBit(&bits[it->first * words], *t);
+    }
+  }
+
+  int get_num_of_trees() const { return num_of_trees; }
+  int num_words() const { return words; }
+
+  // the trees node occurs in, or 0 if it is missing from the tree map
+  const bitword_t* occurs(node_label_t node) const {
+    return (node >= 0 && (size_t)node < found.size() && found[node]) ? &bits[node * words] : 0; }
+
+  bool in_some_tree(node_label_t node) const {
+    return occurs(node) && PopCount(occurs(node), words) > 0; }
+
+ private:
+
+  int num_of_trees;
+  int words;
+  vector<bitword_t> bits;
+  vector<char> found;
+};
+
+//
+// A set of nodes (non-negative integer labels) and the trees, out of 0..N,
+// that none of the nodes occur in, both kept as bitsets. Node bitsets have no
+// trailing zero words, so equal sets have equal words. Sets are ordered like
+// set<node_label_t>, by a lexicographic compare of their sorted nodes.
+//
 template<class node_label_t, class tree_label_t>
 class scored_set {
 
  private:
 
-  set<node_label_t> nodes;
-  set<tree_label_t> trees;
+  vector<bitword_t> nodes;
+  vector<bitword_t> trees;
+  int num_of_free_trees;    // number of bits set in trees
+
+  scored_set() { }
+
+  void trim_nodes() { while(!nodes.empty() && nodes.back() == 0) nodes.pop_back(); }
+
+  // true if w has a bit set above the single bit low of word i
+  static bool has_bit_above(const vector<bitword_t>& w, size_t i, bitword_t low) {
+    if(i >= w.size()) return false;
+    return (w[i] & ~(low | (low - 1))) != 0 || i + 1 < w.size(); }
   
  public:
 
-  scored_set(const set<node_label_t>& given_nodes, const set<tree_label_t>& given_trees)
-    : nodes(given_nodes), trees(given_trees) { }
+  // the nodes [begin, end) must be sorted
+  template<class iterator>
+  scored_set(iterator begin, iterator end, const tree_bitmaps<node_label_t, tree_label_t>& tree_map) {
 
-  scored_set(const set<node_label_t>& given_nodes, 
-	     map<node_label_t, set<tree_label_t> >& tree_map, int num_of_trees) : nodes(given_nodes) {
+    if(begin != end)
+      nodes.assign(WordsFor(*prev(end) + 1), 0);
+    trees.assign(tree_map.num_words(), 0);
 
-    typename set<node_label_t>::iterator it = nodes.begin();
-    trees = tree_map[*it];
-  
-    for(it++; it != nodes.end(); it++) {
+    // the trees any of the nodes occur in
+    for(iterator it = begin; it != end; it++) {
 
-      set<node_label_t> result;
-      set_union(trees.begin(), trees.end(), 
-		tree_map[*it].begin(), tree_map[*it].end(),
-		inserter(result, result.begin()));
-      swap(result, trees);
+      SetBit(&nodes[0], *it);
+      const bitword_t* occurs = tree_map.occurs(*it);
+      if(occurs)
+	for(size_t i = 0; i < trees.size(); i++)
+	  trees[i] |= occurs[i];
     }
 
-    set<node_label_t> temp;
-    for(int i = 0; i <= num_of_trees; i++)
-      if(trees.find(i) == trees.end())
-	temp.insert(i);
-
-    swap(temp, trees);
+    // and the ones they don't
+    for(size_t i = 0; i < trees.size(); i++)
+      trees[i] = ~trees[i];
+    int extra = trees.size() * BITS_PER_WORD - (tree_map.get_num_of_trees() + 1);
+    if(extra > 0)
+      trees.back() &= ~bitword_t(0) >> extra;
+    num_of_free_trees = PopCount(&trees[0], trees.size());
   }
 
-  const set<node_label_t>& get_nodes() const { return nodes; }
-  bool operator<(const scored_set& a) const 
-    { return nodes < a.nodes; }
+  set<node_label_t> get_nodes() const { 
+
+    vector<int> pos; 
+    BitPositions(nodes.empty() ? 0 : &nodes[0], nodes.size(), pos);
+    return set<node_label_t>(pos.begin(), pos.end()); }
+
+  size_t num_nodes() const { return PopCount(nodes.empty() ? 0 : &nodes[0], nodes.size()); }
 
+  uint64_t fingerprint() const { return HashWords(nodes.empty() ? 0 : &nodes[0], nodes.size()); }
+
+  bool operator==(const scored_set& a) const { return nodes == a.nodes; }
+
+  bool operator<(const scored_set& a) const {
+
+    // the sorted nodes agree up to the lowest bit where the sets differ; the
+    // set holding that node is smaller unless the other set ends there
+    size_t n = max(nodes.size(), a.nodes.size());
+    for(size_t i = 0; i < n; i++) {
+
+      bitword_t mine = (i < nodes.size()) ? nodes[i] : 0;
+      bitword_t theirs = (i < a.nodes.size()) ? a.nodes[i] : 0;
+      if(mine == theirs) continue;
+
+      bitword_t diff = mine ^ theirs, low = diff & (~diff + 1);
+      if(mine & low) 
+	return has_bit_above(a.nodes, i, low);
+      else
+	return !has_bit_above(nodes, i, low);
+    }
+    return false;
+  }
+
+  // the subtraction is unsigned as it was with set::size(), so nodes that
+  // occur in no tree at all have a huge score
   double score(int num_of_trees) const { 
-    return (nodes.size() > 0 ? (num_of_trees-trees.size())/double(num_of_trees) : 0); }
+    return (!nodes.empty() ? (num_of_trees-size_t(num_of_free_trees))/double(num_of_trees) : 0); }
 
   scored_set intersect(const scored_set& to_intersect) const {
 
-      set<node_label_t> node_intersection;
-      set_intersection(nodes.begin(), nodes.end(), to_intersect.nodes.begin(), to_intersect.nodes.end(),
-		       inserter(node_intersection, node_intersection.begin()));
+    scored_set result;
+    size_t n = min(nodes.size(), to_intersect.nodes.size());
+    result.nodes.resize(n);
+    for(size_t i = 0; i < n; i++)
+      result.nodes[i] = nodes[i] & to_intersect.nodes[i];
+    result.trim_nodes();
+
+    const vector<bitword_t>& longer = (trees.size() >= to_intersect.trees.size()) ? trees : to_intersect.trees;
+    const vector<bitword_t>& shorter = (trees.size() >= to_intersect.trees.size()) ? to_intersect.trees : trees;
+    result.trees = longer;
+    for(size_t i = 0; i < shorter.size(); i++)
+      result.trees[i] |= shorter[i];
+    result.num_of_free_trees = PopCount(&result.trees[0], result.trees.size());
+    return result;
+  }
+};
+
+//
+// A set of scored_sets, keyed by their nodes: a vector in the order the sets
+// were added, indexed by the fingerprints of their nodes. Sets with the same
+// fingerprint are told apart by comparing their nodes.
+//
+template<class node_label_t, class tree_label_t>
+class scored_set_table {
+
+ public:
+
+  typedef scored_set<node_label_t, tree_label_t> value_type;
+
+  bool contains(const value_type& s) const { return find(s, s.fingerprint()) >= 0; }
+
+  // add s unless a set with the same nodes is already here
+  bool insert(const value_type& s) { return insert(s, s.fingerprint()); }
+
+  // the same, for an s whose fingerprint h is already known
+  bool insert(const value_type& s, uint64_t h) {
 
-      set<tree_label_t> tree_intersection;
-      set_union(trees.begin(), trees.end(), to_intersect.trees.begin(), to_intersect.trees.end(),
-		inserter(tree_intersection, tree_intersection.begin()));
+    if(find(s, h) >= 0) return false;
+    index.insert(make_pair(h, sets.size()));
+    sets.push_back(s);
+    return true;
+  }
+
+  const vector<value_type>& get_sets() const { return sets; }
+  size_t size() const { return sets.size(); }
+
+ private:
+
+  long find(const value_type& s, uint64_t h) const {
 
-      return scored_set(node_intersection, tree_intersection);
+    typedef typename unordered_multimap<uint64_t, size_t>::const_iterator iterator;
+    pair<iterator, iterator> range = index.equal_range(h);
+    for(iterator it = range.first; it != range.second; it++)
+      if(sets[it->second] == s) return it->second;
+    return -1;
   }
+
+  vector<value_type> sets;
+  unordered_multimap<uint64_t, size_t> index;
 };
 
 #endif
@@ -0,0 +1,123 @@
+#include <fstream>
+#include "segment.h"
+#include "util.h"
+
+//===========================================================================
+// Segment data
+//===========================================================================
+
+SegmentData::SegmentData(const string & base)
+    : _base(base), _num_trees(0), _tree_bits(0), _dist(0)
+{
+}
+
+
+SegmentData::~SegmentData()
+{
+    delete _tree_bits;
+    delete _dist;
+}
+
+
+const SplitDatabase &
+SegmentData::splits()
+{
+    call_once(_splits_once, [this]() {
+        string name = _base + "_splits";
+        ifstream in(name.c_str());
+        DIE_IF(!in, "Can't find file " + name);
+        ReadSplitsMapping(in, _splits);
+    });
+    return _splits;
+}
+
+
+// a missing _trees file reads as no trees, as extract_reassortments did
+void
+SegmentData::ReadTrees()
+{
+    string name = _base + "_trees";
+    ifstream in(name.c_str());
+    if (!in)
+    {
+        cerr << "Could not read the file " << name << endl;
+        return;
+    }
+    ReadSplitTrees(in, _num_trees, _trees);
+}
+
+
+int
+SegmentData::num_trees()
+{
+    call_once(_trees_once, [this]() { ReadTrees(); });
+    return _num_trees;
+}
+
+
+const map<int, set<int> > &
+SegmentData::trees()
+{
+    call_once(_trees_once, [this]() { ReadTrees(); });
+    return _trees;
+}
+
+
+// built once, however many pairs and labels the segment is in
+const tree_bitmaps<int, int> &
+SegmentData::tree_bits()
+{
+    call_once(_bits_once, [this]() { 
+        _tree_bits = new tree_bitmaps<int, int>(trees(), num_trees()); 
+    });
+    return *_tree_bits;
+}
+
+
+const DistSummaries &
+SegmentData::distances(ostream & log)
+{
+    call_once(_dist_once, [&]() { _dist = new DistSummaries(_base, log); });
+    return *_dist;
+}
+
+
+void
+SegmentData::Store(
+    const SplitDatabase & splits,
+    int num_trees,
+    const vector<DistanceMatrix> * distances
+    )
+{
+    // the splits are numbered as they are in the files
+    call_once(_splits_once, [&]() { 
+        NumberSplits(splits, _splits, _trees); 
+        _num_trees = num_trees;
+    });
+    call_once(_trees_once, []() {});
+    if (distances)
+    {
+        call_once(_dist_once, [&]() { _dist = new DistSummaries(*distances); });
+    }
+}
+
+
+SegmentCache::~SegmentCache()
+{
+    for (map<string, SegmentData *>::iterator S = _segments.begin();
+         S != _segments.end();
+         ++S)
+    {
+        delete S->second;
+    }
+}
+
+
+SegmentData &
+SegmentCache::Get(const string & base)
+{
+    lock_guard<mutex> guard(_lock);
+    SegmentData *& S = _segments[base];
+    if (!S) S = new SegmentData(base);
+    return *S;
+}
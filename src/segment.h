@@ -0,0 +1,63 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+#include <mutex>
+#include "splits.h"
+#include "dist.h"
+#include "scored_set.h"
+
+//
+// What every pair of segments needs to know about one segment: its splits,
+// the trees each split occurs in and the summaries of its distances. Each
+// part is read from the segment's files the first time it is asked for, so
+// a segment is read only once however many pairs it is in, unless the parts
+// were stored directly from the segment's trees. The parts are not changed
+// after they are read and can be shared between threads.
+//
+class SegmentData
+{
+public:
+    explicit SegmentData(const string & base);
+    ~SegmentData();
+
+    const string & base() const { return _base; }
+
+    const SplitDatabase & splits();             // <base>_splits
+    int num_trees();                            // <base>_trees
+    const map<int, set<int> > & trees();
+    const tree_bitmaps<int, int> & tree_bits(); // trees() as bitsets
+    const DistSummaries & distances(ostream &); // <base>_distsum
+
+    // set the parts from the splits of the trees and their distances (if
+    // not 0), instead of reading the files
+    void Store(const SplitDatabase &, int, const vector<DistanceMatrix> *);
+
+private:
+    void ReadTrees();
+
+    string _base;
+
+    once_flag _splits_once, _trees_once, _bits_once, _dist_once;
+    SplitDatabase _splits;
+    int _num_trees;
+    map<int, set<int> > _trees;
+    tree_bitmaps<int, int> * _tree_bits;
+    DistSummaries * _dist;
+};
+
+
+//
+// The segments that have been read, by base name.
+//
+class SegmentCache
+{
+public:
+    ~SegmentCache();
+
+    SegmentData & Get(const string & base);
+
+private:
+    mutex _lock;
+    map<string, SegmentData *> _segments;
+};
+
+#endif
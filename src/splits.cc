@@ -102,6 +102,75 @@ SplitsAreIncompatible(
 }
 
 
+// Number the taxa of both databases in sorted order
+void
+IndexTaxa(
+    const SplitDatabase & a,
+    const SplitDatabase & b,
+    map<string, int> & index // out
+    )
+{
+    set<string> taxa;
+    const SplitDatabase * dbs[2] = {&a, &b};
+    for (int k = 0; k < 2; k++)
+    {
+        for (SplitDatabase::const_iterator S = dbs[k]->begin();
+             S != dbs[k]->end();
+             ++S)
+        {
+            taxa.insert(S->first.first().begin(), S->first.first().end());
+            taxa.insert(S->first.second().begin(), S->first.second().end());
+        }
+    }
+
+    index.clear();
+    int i = 0;
+    for (set<string>::iterator T = taxa.begin(); T != taxa.end(); ++T)
+    {
+        index[*T] = i++;
+    }
+}
+
+
+SplitBitsets::SplitBitsets(
+    const SplitDatabase & splits,
+    const map<string, int> & index
+    )
+{
+    _words = WordsFor(index.size());
+    _bits.assign(2 * _words * splits.size(), 0);
+
+    vector<pair<int, const Split *> > by_id;
+    for (SplitDatabase::const_iterator S = splits.begin();
+         S != splits.end();
+         ++S)
+    {
+        by_id.push_back(make_pair(S->first.id, &S->first));
+    }
+    sort(by_id.begin(), by_id.end());
+
+    for (unsigned i = 0; i < by_id.size(); i++)
+    {
+        const Split * S = by_id[i].second;
+        _ids.push_back(S->id);
+
+        bitword_t * sides[2] = {&_bits[2 * i * _words], &_bits[(2 * i + 1) * _words]};
+        const set<string> * taxa[2] = {&S->first(), &S->second()};
+        for (int k = 0; k < 2; k++)
+        {
+            for (set<string>::const_iterator T = taxa[k]->begin();
+                 T != taxa[k]->end();
+                 ++T)
+            {
+                map<string, int>::const_iterator I = index.find(*T);
+                assert(I != index.end());
+                SetBit(sides[k], I->second);
+            }
+        }
+    }
+}
+
+
 void
 AddSplit(
     SplitDatabase & splits, 
@@ -299,3 +368,58 @@ PrintTreesForSplits(
     } 
 }
 
+
+
+// Will read a _trees file produced by PrintTreesForSplits: for every split,
+// the set of trees it occurs in.
+void
+ReadSplitTrees(
+    istream & in,
+    int & num_trees,                // out
+    map<int, set<int> > & trees     // out
+    )
+{
+    string mark;
+    int num_splits;
+    in >> mark >> num_trees >> num_splits;
+
+    for (int i = 0; i < num_splits && in; i++)
+    {
+        int split, count, tree;
+        in >> split >> count;
+        set<int> & T = trees[split];
+        for (int j = 0; j < count; j++) 
+        {
+            in >> tree;
+            T.insert(tree);
+        }
+    }
+}
+
+
+// The splits as ReadSplitsMapping and ReadSplitTrees read them back from the
+// files that PrintSplitsMapping and PrintTreesForSplits write: numbered in
+// order, larger side first, with the empty side of the trivial split read as
+// an empty taxon, and their trees moved to a map from split ids.
+void
+NumberSplits(
+    const SplitDatabase & splits,
+    SplitDatabase & numbered,       // out
+    map<int, set<int> > & trees     // out
+    )
+{
+    int split = 0;
+    for (SplitDatabase::const_iterator S = splits.begin();
+        S != splits.end();
+        ++S)
+    {
+        set<string> a = S->first.first();
+        set<string> b = S->first.second();
+        if (a.size() < b.size()) swap(a,b);
+        if (b.empty()) b.insert("");
+
+        numbered[Split(a, b, split)];
+        trees[split] = S->second;
+        split++;
+    }
+}
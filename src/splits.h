@@ -1,6 +1,7 @@
 #ifndef SPLITS_H
 #define SPLITS_H
 #include "tree.h"
+#include "bitvec.h"
 #include <set>
 #include <map>
 #include <string>
@@ -35,9 +36,48 @@ private:
 
 typedef map<Split, set<int> > SplitDatabase;
 
+//
+// A packed copy of a SplitDatabase, in split id order: for every split, the
+// bits of its first side followed by the bits of its second side, using a
+// taxon index shared by the databases that are compared.
+//
+class SplitBitsets
+{
+public:
+    SplitBitsets(const SplitDatabase &, const map<string, int> &);
+
+    int size() const { return _ids.size(); }
+    int words() const { return _words; }
+    int id(int i) const { return _ids[i]; }
+
+    const bitword_t * first(int i) const { return &_bits[2 * i * _words]; }
+    const bitword_t * second(int i) const { return first(i) + _words; }
+
+private:
+    int _words;
+    vector<int> _ids;
+    vector<bitword_t> _bits;
+};
+
+// Same as SplitsAreIncompatible, on split a of A and split b of B; W is the
+// number of words per side, or 0 if it isn't known at compile time.
+template <int W>
+inline bool
+SplitBitsAreIncompatible(
+    const SplitBitsets & A, int a, 
+    const SplitBitsets & B, int b)
+{
+    int w = A.words();
+    return Intersects<W>(A.first(a), B.first(b), w) &&
+           Intersects<W>(A.first(a), B.second(b), w) &&
+           Intersects<W>(A.second(a), B.first(b), w) &&
+           Intersects<W>(A.second(a), B.second(b), w);
+}
+
 void AllSplits(vector<TreeNode *> &, SplitDatabase &);
 void CullSplits(SplitDatabase &, unsigned); 
 bool SplitsAreIncompatible(const Split &, const Split &);
+void IndexTaxa(const SplitDatabase &, const SplitDatabase &, map<string, int> &);
 
 void SetDifference(const set<string> &, const set<string> &, set<string> &);
 void SetIntersection(const set<string> &, const set<string> &, set<string> &);
@@ -48,4 +88,6 @@ void PrintSplitsReadable(ostream & , SplitDatabase &, unsigned = 1);
 void PrintSplitsMapping(ostream &, SplitDatabase &);
 void ReadSplitsMapping(istream &, SplitDatabase &);
 void PrintTreesForSplits(ostream & , int , SplitDatabase & );
+void ReadSplitTrees(istream &, int &, map<int, set<int> > &);
+void NumberSplits(const SplitDatabase &, SplitDatabase &, map<int, set<int> > &);
 #endif
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include "taxon_order.h"
+
+//===========================================================================
+// Taxon Orders
+//===========================================================================
+
+TaxonOrder::TaxonOrder(const vector<string> & order)
+    : _order(order)
+{
+    for (unsigned i = 0; i < _order.size(); i++)
+    {
+        _pos[_order[i]] = i;
+    }
+}
+
+
+int
+TaxonOrder::position(const string & taxon) const
+{
+    map<string, int>::const_iterator P = _pos.find(taxon);
+    return (P == _pos.end()) ? -1 : P->second;
+}
+
+
+// Convert positions (in any order) into a sorted list of maximal runs
+void
+PositionsToIntervals(
+    vector<int> & pos,
+    IntervalSet & runs
+    )
+{
+    sort(pos.begin(), pos.end());
+
+    runs.clear();
+    for (unsigned i = 0; i < pos.size(); i++)
+    {
+        if (runs.empty() || runs.back().second != pos[i])
+        {
+            runs.push_back(make_pair(pos[i], pos[i] + 1));
+        }
+        else
+        {
+            runs.back().second++;
+        }
+    }
+}
+
+
+// Convert the set into a sorted list of maximal runs of positions; returns
+// false if some taxon of the set is not in the order
+bool
+TaxonOrder::ToIntervals(
+    const set<string> & S,
+    IntervalSet & runs
+    ) const
+{
+    vector<int> pos;
+    for (set<string>::const_iterator I = S.begin();
+         I != S.end();
+         ++I)
+    {
+        int p = position(*I);
+        if (p < 0) return false;
+        pos.push_back(p);
+    }
+    PositionsToIntervals(pos, runs);
+    return true;
+}
+
+
+struct CladeNode
+{
+    const set<string> * clade;
+    vector<int> children;
+    vector<string> owned;     // taxa in no smaller clade
+};
+
+
+bool
+BySizeDesc(const set<string> * a, const set<string> * b)
+{
+    return a->size() > b->size();
+}
+
+
+// return the lexicographically smallest taxon under node n
+const string &
+MinTaxon(vector<CladeNode> & nodes, int n)
+{
+    return nodes[n].owned.empty() ?
+        *nodes[n].clade->begin() :
+        min(*nodes[n].clade->begin(), nodes[n].owned.front());
+}
+
+
+void
+EmitLeafOrder(
+    vector<CladeNode> & nodes,
+    int n,
+    vector<string> & order
+    )
+{
+    // visit the owned taxa and child clades by their smallest taxon
+    vector<pair<string, int> > items;
+    for (unsigned i = 0; i < nodes[n].owned.size(); i++)
+    {
+        items.push_back(make_pair(nodes[n].owned[i], -1));
+    }
+    for (unsigned i = 0; i < nodes[n].children.size(); i++)
+    {
+        int c = nodes[n].children[i];
+        items.push_back(make_pair(MinTaxon(nodes, c), c));
+    }
+    sort(items.begin(), items.end());
+
+    for (unsigned i = 0; i < items.size(); i++)
+    {
+        if (items[i].second < 0) order.push_back(items[i].first);
+        else EmitLeafOrder(nodes, items[i].second, order);
+    }
+}
+
+
+/*
+ * Order the taxa by a depth-first walk of the majority-rule consensus of the
+ * given splits. counts maps split ids to the number of trees (out of
+ * num_trees) that contain the split. Every clade of the consensus tree is
+ * contiguous in the resulting order.
+ */
+void
+ConsensusLeafOrder(
+    const SplitDatabase & splits,
+    const map<int, int> & counts,
+    int num_trees,
+    vector<string> & order // out
+    )
+{
+    order.clear();
+    if (splits.empty()) return;
+
+    // all taxa; the consensus tree is rooted at the first one. The trivial
+    // split is read back from _splits with an empty taxon on its empty side.
+    set<string> taxa = splits.begin()->first.first();
+    taxa.insert(splits.begin()->first.second().begin(),
+                splits.begin()->first.second().end());
+    taxa.erase("");
+    const string & root = *taxa.begin();
+
+    // majority splits are pairwise compatible, so their sides that don't
+    // contain the root form a laminar family
+    vector<const set<string> *> clades;
+    for (SplitDatabase::const_iterator S = splits.begin();
+         S != splits.end();
+         ++S)
+    {
+        const set<string> & A = S->first.first();
+        const set<string> & B = S->first.second();
+        map<int, int>::const_iterator C = counts.find(S->first.id);
+        int count = (C == counts.end()) ? 0 : C->second;
+        if (2 * count > num_trees && 
+            A.find("") == A.end() && B.find("") == B.end())
+        {
+            clades.push_back(A.find(root) == A.end() ? &A : &B);
+        }
+    }
+    sort(clades.begin(), clades.end(), BySizeDesc);
+
+    // node 0 is the root; every clade hangs from the smallest clade that
+    // contains it
+    vector<CladeNode> nodes(clades.size() + 1);
+    nodes[0].clade = &taxa;
+    map<string, int> owner;
+    for (set<string>::iterator T = taxa.begin(); T != taxa.end(); ++T)
+    {
+        owner[*T] = 0;
+    }
+
+    for (unsigned i = 0; i < clades.size(); i++)
+    {
+        int n = i + 1;
+        nodes[n].clade = clades[i];
+        nodes[owner[*clades[i]->begin()]].children.push_back(n);
+
+        for (set<string>::const_iterator T = clades[i]->begin();
+             T != clades[i]->end();
+             ++T)
+        {
+            owner[*T] = n;
+        }
+    }
+
+    for (map<string, int>::iterator O = owner.begin(); O != owner.end(); ++O)
+    {
+        nodes[O->second].owned.push_back(O->first);
+    }
+
+    EmitLeafOrder(nodes, 0, order);
+    assert(order.size() == taxa.size());
+}
+
+
+//===========================================================================
+// Range sums over the moved matrix
+//===========================================================================
+
+// Fill the sums from the moved matrix; returns false, and leaves the sums
+// empty, if the order has more than MAX_TAXA taxa or is missing a taxon of
+// the matrix
+bool
+MovedRangeSums::Build(
+    const TaxonOrder & order,
+    DistanceMatrix & moved_matrix
+    )
+{
+    int n = order.size();
+    if (n > MAX_TAXA) return false;
+    _stride = n + 1;
+    _ge.assign(_stride * _stride, 0);
+    _le.assign(_stride * _stride, 0);
+
+    // scatter the (symmetric) matrix into the order, shifted by one
+    for (DistanceMatrix::iterator M = moved_matrix.begin();
+         M != moved_matrix.end();
+         ++M)
+    {
+        int i = order.position(M->first) + 1;
+        for (map<string, double>::iterator I = M->second.begin();
+             I != M->second.end();
+             ++I)
+        {
+            int j = order.position(I->first) + 1;
+            if (i == 0 || j == 0)
+            {
+                _ge.clear();
+                _le.clear();
+                return false;
+            }
+            if (I->second > 0)
+            {
+                _ge[i * _stride + j] = _ge[j * _stride + i] = 1;
+            }
+            if (I->second < 0)
+            {
+                _le[i * _stride + j] = _le[j * _stride + i] = 1;
+            }
+        }
+    }
+
+    // P[i][j] = sum of entries in rows < i and columns < j
+    for (int i = 1; i < _stride; i++)
+    {
+        for (int j = 1; j < _stride; j++)
+        {
+            int k = i * _stride + j;
+            _ge[k] += _ge[k - 1] + _ge[k - _stride] - _ge[k - _stride - 1];
+            _le[k] += _le[k - 1] + _le[k - _stride] - _le[k - _stride - 1];
+        }
+    }
+    return true;
+}
+
+
+// sum of the entries in rows [r0, r1) and columns [c0, c1)
+long
+MovedRangeSums::Rect(
+    const vector<int> & P,
+    int r0, int r1,
+    int c0, int c1
+    ) const
+{
+    return (long)P[r1 * _stride + c1] - P[r0 * _stride + c1]
+         - P[r1 * _stride + c0] + P[r0 * _stride + c0];
+}
+
+
+// count the pairs in a x b that moved in either direction
+void
+MovedRangeSums::Count(
+    const IntervalSet & a,
+    const IntervalSet & b,
+    long & ge_count, // out
+    long & le_count  // out
+    ) const
+{
+    ge_count = le_count = 0;
+    for (IntervalSet::const_iterator A = a.begin(); A != a.end(); ++A)
+    {
+        for (IntervalSet::const_iterator B = b.begin(); B != b.end(); ++B)
+        {
+            ge_count += Rect(_ge, A->first, A->second, B->first, B->second);
+            le_count += Rect(_le, A->first, A->second, B->first, B->second);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef TAXON_ORDER_H
+#define TAXON_ORDER_H
+#include <vector>
+#include "tree.h"
+#include "splits.h"
+
+//
+// A set of taxa stored as half-open runs [first, second) of positions in a
+// TaxonOrder. Sets that are (nearly) clades of a tree compatible with the
+// order have only a few runs.
+//
+typedef vector<pair<int, int> > IntervalSet;
+
+void PositionsToIntervals(vector<int> &, IntervalSet &);
+
+class TaxonOrder
+{
+public:
+    TaxonOrder(const vector<string> & order);
+
+    int size() const { return _order.size(); }
+    int position(const string & taxon) const;   // -1 if not in the order
+    const string & taxon(int pos) const { return _order[pos]; }
+
+    bool ToIntervals(const set<string> &, IntervalSet &) const;
+
+private:
+    vector<string> _order;
+    map<string, int> _pos;
+};
+
+void ConsensusLeafOrder(const SplitDatabase &, const map<int, int> &, int, vector<string> &);
+
+
+//
+// 2D prefix sums over the moved matrix, permuted into a TaxonOrder, so that
+// the number of "greater" and "lesser" pairs between two IntervalSets can
+// be counted in O(#runs(a) * #runs(b)). The two tables take 8 (n+1)^2
+// bytes for n taxa, and their int entries limit n to MAX_TAXA.
+//
+class MovedRangeSums
+{
+public:
+    static const int MAX_TAXA = 46339;
+
+    bool Build(const TaxonOrder &, DistanceMatrix &);
+    void Count(const IntervalSet &, const IntervalSet &, long &, long &) const;
+
+private:
+    long Rect(const vector<int> &, int, int, int, int) const;
+
+    int _stride;
+    vector<int> _ge;
+    vector<int> _le;
+};
+
+#endif
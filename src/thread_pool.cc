@@ -0,0 +1,235 @@
+#include <chrono>
+#include <cassert>
+#include "thread_pool.h"
+
+// the pool and worker index of the worker running on this thread
+static thread_local ThreadPool * current_pool = 0;
+static thread_local int current_worker = -1;
+
+//===========================================================================
+// Thread Pool
+//===========================================================================
+
+ThreadPool::ThreadPool(int num_threads)
+    : _queued(0), _next_queue(0), _done(false)
+{
+    for (int i = 0; i < num_threads - 1; i++)
+    {
+        _queues.push_back(new Queue());
+    }
+    for (int i = 0; i < num_threads - 1; i++)
+    {
+        _workers.push_back(thread(&ThreadPool::WorkerLoop, this, i));
+    }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> l(_idle_lock);
+        _done = true;
+    }
+    _idle.notify_all();
+    for (unsigned i = 0; i < _workers.size(); i++)
+    {
+        _workers[i].join();
+    }
+    for (unsigned i = 0; i < _queues.size(); i++)
+    {
+        delete _queues[i];
+    }
+}
+
+
+void
+ThreadPool::Submit(const Task & task)
+{
+    // workers push onto their own queue; everyone else deals round robin
+    int q = (current_pool == this) ? current_worker : 
+        (int)(_next_queue++ % _queues.size());
+    {
+        lock_guard<mutex> l(_queues[q]->lock);
+        _queues[q]->tasks.push_back(task);
+    }
+    {
+        lock_guard<mutex> l(_idle_lock);
+        _queued++;
+    }
+    _idle.notify_one();
+}
+
+
+// pop the newest task of our own queue, or steal the oldest of another
+bool
+ThreadPool::Take(int self, Task & task)
+{
+    int n = _queues.size();
+    if (self >= 0)
+    {
+        lock_guard<mutex> l(_queues[self]->lock);
+        if (!_queues[self]->tasks.empty())
+        {
+            task = _queues[self]->tasks.back();
+            _queues[self]->tasks.pop_back();
+            _queued--;
+            return true;
+        }
+    }
+
+    for (int k = 1; k <= n; k++)
+    {
+        int victim = ((self >= 0 ? self : 0) + k) % n;
+        lock_guard<mutex> l(_queues[victim]->lock);
+        if (!_queues[victim]->tasks.empty())
+        {
+            task = _queues[victim]->tasks.front();
+            _queues[victim]->tasks.pop_front();
+            _queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool
+ThreadPool::RunOne()
+{
+    Task task;
+    int self = (current_pool == this) ? current_worker : -1;
+    if (_queues.empty() || !Take(self, task)) return false;
+    task();
+    return true;
+}
+
+
+void
+ThreadPool::WorkerLoop(int self)
+{
+    current_pool = this;
+    current_worker = self;
+    while (true)
+    {
+        Task task;
+        if (Take(self, task))
+        {
+            task();
+            continue;
+        }
+
+        unique_lock<mutex> l(_idle_lock);
+        _idle.wait(l, [this]() { return _done || _queued > 0; });
+        if (_done && _queued == 0) return;
+    }
+}
+
+
+//===========================================================================
+// Task Groups
+//===========================================================================
+
+TaskGroup::TaskGroup(ThreadPool * pool)
+    : _pool((pool && pool->size() > 1) ? pool : 0), _outstanding(0)
+{
+}
+
+
+void
+TaskGroup::Run(const ThreadPool::Task & task)
+{
+    if (!_pool)
+    {
+        task();
+        return;
+    }
+
+    _outstanding++;
+    _pool->Submit([this, task]() {
+        task();
+        lock_guard<mutex> l(_lock);
+        if (--_outstanding == 0) _finished.notify_all();
+    });
+}
+
+
+// help run tasks until all of ours are done
+void
+TaskGroup::Wait()
+{
+    while (_outstanding > 0)
+    {
+        if (_pool->RunOne()) continue;
+
+        unique_lock<mutex> l(_lock);
+        _finished.wait_for(l, chrono::milliseconds(1), 
+            [this]() { return _outstanding == 0; });
+    }
+
+    // the last task may still be holding the lock
+    lock_guard<mutex> l(_lock);
+}
+
+
+//===========================================================================
+// Task graphs
+//===========================================================================
+
+TaskGraph::~TaskGraph()
+{
+    _group.Wait();
+    for (unsigned i = 0; i < _nodes.size(); i++)
+    {
+        delete _nodes[i];
+    }
+}
+
+
+int
+TaskGraph::Add(const ThreadPool::Task & task, const vector<int> & deps)
+{
+    int id = _nodes.size();
+    Node * node = new Node;
+    node->task = task;
+    node->waiting = deps.size();
+    for (unsigned i = 0; i < deps.size(); i++)
+    {
+        assert(deps[i] < id);
+        _nodes[deps[i]]->dependents.push_back(id);
+    }
+    _nodes.push_back(node);
+    return id;
+}
+
+
+// run task n, then start the dependents it was the last dependency of
+void
+TaskGraph::Start(int n)
+{
+    _group.Run([this, n]() {
+        _nodes[n]->task();
+        const vector<int> & dependents = _nodes[n]->dependents;
+        for (unsigned i = 0; i < dependents.size(); i++)
+        {
+            if (--_nodes[dependents[i]]->waiting == 0) Start(dependents[i]);
+        }
+    });
+}
+
+
+void
+TaskGraph::Run()
+{
+    // find the roots before starting any, since a task that finishes can
+    // bring the count of the tasks after it down to 0
+    vector<int> roots;
+    for (unsigned i = 0; i < _nodes.size(); i++)
+    {
+        if (_nodes[i]->waiting == 0) roots.push_back(i);
+    }
+    for (unsigned i = 0; i < roots.size(); i++)
+    {
+        Start(roots[i]);
+    }
+    _group.Wait();
+}
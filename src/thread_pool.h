@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+using namespace std;
+
+//
+// A work-stealing thread pool. Every worker owns a deque of tasks: it runs
+// its own tasks newest first and, when it runs out, steals the oldest task
+// of another worker. Tasks submitted from outside the pool are dealt out
+// round robin. A pool of N threads starts N-1 workers; the thread that waits
+// on a TaskGroup runs tasks too.
+//
+class ThreadPool
+{
+public:
+    typedef function<void()> Task;
+
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    int size() const { return _workers.size() + 1; }
+
+    void Submit(const Task &);
+
+    // run one pending task on the calling thread; false if there was none
+    bool RunOne();
+
+private:
+    struct Queue
+    {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    bool Take(int self, Task &);
+    void WorkerLoop(int self);
+
+    vector<Queue *> _queues;
+    vector<thread> _workers;
+    atomic<long> _queued;
+    atomic<unsigned> _next_queue;
+    mutex _idle_lock;
+    condition_variable _idle;
+    bool _done;
+};
+
+
+//
+// A set of tasks that can be waited on. Without a pool (or with a pool of one
+// thread) tasks run immediately on the calling thread.
+//
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool * pool);
+    ~TaskGroup() { Wait(); }
+
+    void Run(const ThreadPool::Task &);
+    void Wait();
+
+private:
+    ThreadPool * _pool;
+    atomic<long> _outstanding;
+    mutex _lock;
+    condition_variable _finished;
+};
+
+
+//
+// Tasks with dependencies between them. Run() starts the tasks that depend
+// on nothing and every other task as soon as the last of its dependencies is
+// done, and returns when all of them are done. Without a pool the tasks run
+// one at a time on the calling thread, each as soon as it can.
+//
+class TaskGraph
+{
+public:
+    explicit TaskGraph(ThreadPool * pool) : _group(pool) {}
+    ~TaskGraph();
+
+    // add a task that runs after the tasks deps; returns its id
+    int Add(const ThreadPool::Task &, const vector<int> & deps = vector<int>());
+    void Run();
+
+private:
+    struct Node
+    {
+        ThreadPool::Task task;
+        vector<int> dependents;
+        atomic<int> waiting;    // number of unfinished dependencies
+    };
+
+    void Start(int);
+
+    vector<Node *> _nodes;
+    TaskGroup _group;
+};
+
+
+//
+// Call f(begin, end) on consecutive chunks of [0, n) of the given size, in
+// parallel on pool. Returns after every chunk is done.
+//
+template <class F>
+void
+ParallelChunks(ThreadPool * pool, long n, long chunk, F f)
+{
+    TaskGroup group(pool);
+    for (long begin = 0; begin < n; begin += chunk)
+    {
+        long end = min(n, begin + chunk);
+        group.Run([=]() { f(begin, end); });
+    }
+    group.Wait();
+}
+
+#endif
@@ -604,7 +604,8 @@ ComputeDistanceMatrix(
 
 vector<DistanceMatrix> *
 AllDistanceMatrices(
-    vector<TreeNode *> & trees
+    vector<TreeNode *> & trees,
+    ostream & log   // for the progress counter
     )
 {
     vector<DistanceMatrix> * all_dist = new vector<DistanceMatrix>(trees.size());
@@ -615,7 +616,7 @@ AllDistanceMatrices(
         T != trees.end();
         ++T)
     {
-        WriteStatusNumber(cout, i);
+        WriteStatusNumber(log, i);
         ComputeDistanceMatrix(*T, (*all_dist)[i]);
         ScaleDistanceMatrix(*T, (*all_dist)[i]);
         i++;
@@ -76,7 +76,7 @@ void WriteTreeAsDot( ostream &, TreeNode *);
 
 typedef map<string, map<string, double> > DistanceMatrix;
 
-vector<DistanceMatrix> * AllDistanceMatrices( vector<TreeNode *> & trees); 
+vector<DistanceMatrix> * AllDistanceMatrices(vector<TreeNode *> & trees, ostream & log); 
 
 void ComputeDistanceMatrix(TreeNode *T, DistanceMatrix & M);
 